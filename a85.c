@@ -32,69 +32,277 @@ to parse the source line and convert it into the object bytes that it
 represents. */
 
 /*  Get global goodies:  */
+#if	defined(SERVER) && !defined(A85LIB)
+#define	_GNU_SOURCE	/* struct ucred for SO_PEERCRED */
+#endif
 #include "a85.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#ifdef	PTHREADS
+#include <pthread.h>
+#endif
+#if	defined(SERVER) && !defined(A85LIB)
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <errno.h>
+#endif
 
 /* external routines HRJ*/
 void asm_line(void);
 void lclose(void), lopen(char *), lputs(void);
-void hclose(void), hopen(char *), hputc(unsigned);
-void error(char), fatal_error(char *), warning(char *);
+void hclose(void), hopen(char *), hputc(unsigned), sopen(char *);
+void bclose(void), bopen(char *), bputc(unsigned), bseek(unsigned);
+void bfill(unsigned), brange(unsigned, unsigned);
+void bimage(unsigned char *), bspan(unsigned long *, unsigned long *);
+void error(char), fatal_error(char *), warning(char *), say(char *);
 void lerror(void); /* added to list error count HRJ */
+void clear_symbols(void), abandon(void);
+int open_source(INPUT *, char *);
+void add_source(char *, char *, unsigned);
+char *locate(char *, unsigned *);
+void close_sources(void);
+int cache_get(JOB *);
+void cache_put(JOB *);
 
 void pops(char *), pushc(int), trash(void);
-void hseek(unsigned);
-void unlex(void);
+void hseek(unsigned), hlength(unsigned);
+int hcheck(unsigned);
+void unlex(void), retoken(unsigned), clear_tokens(void);
+void link_tokens(TSTORE *), use_tokens(TSTORE *), suppress(void);
+void take_tokens(TSTORE *);
+unsigned add_tokens(TSTORE *);
+int plain(unsigned);
+int fetch_source(SOURCE *), give_source(SOURCE *);
+unsigned lmark(void), peek(void), tokenize(void);
+int extra(void);
 int isalph(char); /* was int isalph(int) HRJ */
 
 /* these are local but used before defined HRJ */
 static void do_label(void),normal_op(void), pseudo_op(void);
 static void flush(void);
+static void do_operand(unsigned, unsigned, unsigned *);
+static void put_value(unsigned, unsigned, unsigned *);
+static void defer(unsigned, unsigned, char, unsigned *);
+static void save_line(void), resolve(void), replay(void);
+static int next_line(void);
+static unsigned save_text(char *);
+void *grow(void *, unsigned *, unsigned, unsigned);
+static SYMBOL *find_label(void);
+static int do_passes(void);
+static void assemble(void);
+static int parallel(void), in_order(char *);
+#ifdef	PTHREADS
+static void *assemble_part(void *);
+static void checkpoint(CHECK *), resume(CHECK *);
+static int agree(CHECK *, CHECK *);
+static void *scan_files(void *), scan_file(SCAN *);
+static void *fetch_files(void *);
+static int fetch_one(SOURCE *);
+static char *next_inc(char *, char *, char *);
+static void add_fetch(FETCHES *, char *, int);
+#endif
+static void prescan(void), clear_scans(void);
+static int use_scan(char *);
+static void prefetch(void), fetched(char *), stop_fetch(void);
+static unsigned save_title(void);
+static void diagnose(void), clear_lines(void);
+static char *copy(char *, unsigned);
+static void note_file(char *), new_frag(char *), end_frag(void);
+static void snapshot(FRAG *, unsigned), apply(FRAG *, unsigned);
+static int same(FRAG *, unsigned), use_frag(char *);
+static void next_frag(void), end_capture(void), keep_frags(void);
+static void put_line(LINE *, int), clear_frags(void);
+static SOURCE *source_of(char *);
+static void unique(FRAG *);
+static int by_name(const void *, const void *), frag_line(FILE *, char *), hex2(char *);
+static char *frag_nums(char *, unsigned *, unsigned);
+static int is_syms(INPUT *), load_syms(INPUT *, char *);
+static void inc_syms(char *), preload(char *);
+static char *line_of(char *, char *, char *);
+static int streams(JOB *);
+void reserve_symbols(unsigned);
+int swrite(char *), dwrite(JOB *);
+void text_hash(char *, char *, char *, unsigned);
+char *cache_name(JOB *, char *, char *, char *);
+SOURCE *source_list(unsigned *);
+#ifndef	A85LIB
+static unsigned long hexarg(char *, char **);
+static char *outname(char *, char *);
+static void run_jobs(unsigned);
+static int run(int, char **), to_stdout(int, char **);
+#ifdef	SERVER
+static void serve(char *), ask(char *, int, char **);
+static char *sockarg(char **, char **);
+static int sockname(struct sockaddr_un *, char *), send_all(int, char *, unsigned);
+static int peer_ok(int);
+void warm_start(char *), warm_sweep(void);
+#endif
+#endif
 
 
 /*  Define global mailboxes for all modules */
 
 /* Turbo C has "line" as graphic function, change to lline HRJ */
-char errcode, lline[MAXLINE + 1], title[MAXLINE];
-
-int pass = 0;
-int eject, filesp, listhex;
-int forwd; /* Flag for whether we're making a forward reference or not */
-unsigned  address; /* The address shown on the assembly output */
-unsigned bytes, errors, listleft, obj[MAXLINE], pagelen, pc;
-FILE *filestk[FILES], *source;
-TOKEN token;
-
-static int done;
-static int off;	/* Turns assembly off when set to TRUE, initialized to FALSE in main() */
+TLOCAL char errcode, *lline, title[MAXLINE];
+
+TLOCAL int pass = 0;
+TLOCAL int eject, filesp, listhex;
+TLOCAL int forwd; /* Flag for whether we're making a forward reference or not */
+TLOCAL int onepass; /* Assemble in a single pass, patching forward references at the end */
+TLOCAL int pending; /* Flag for an expression that needs a single-pass fixup */
+TLOCAL unsigned  address; /* The address shown on the assembly output */
+TLOCAL unsigned bytes, errors, llen, obj[MAXLINE], pagelen, pc;
+TLOCAL INPUT filestk[FILES], *source;
+TLOCAL TOKEN token;
+TLOCAL jmp_buf *bail; /* Where a fatal error goes to abandon the assembly */
+TLOCAL char *fatal; /* The message of the fatal error that did so */
+TLOCAL int watch; /* Set while an include fragment is being recorded */
+TLOCAL int pcused; /* Set when $ is used or a label takes its value */
+int tostderr; /* Set when an output file goes to stdout */
+
+static TLOCAL JOB *curjob; /* The job being assembled */
+static TLOCAL unsigned maxdiags; /* Room for diagnostics in the job */
+static TLOCAL int done;
+static TLOCAL int replaying; /* Set while pass 2 walks the pass 1 line records */
+static TLOCAL RECORD *rec; /* The record of the line being assembled */
+static TLOCAL unsigned runhead; /* The record that begins a run of skipped lines */
+static TLOCAL int seeking; /* Set when a line moves the hex file load address */
+static TLOCAL unsigned seekto; /* The new hex file load address */
+static TLOCAL int off;	/* Turns assembly off when set to TRUE, initialized to FALSE in do_passes() */
 
 /* The IF stack keeps track of whether or not assembly lines are being
  * processed. It is primed with ASM_ON so that we will indeed be processing
  * even before we hit the first IF statement
  */
-static int ifstack[IFDEPTH] = { ASM_ON };
-static int ifsp; /* Stack pointer for the IF stack */
+static TLOCAL int ifstack[IFDEPTH] = { ASM_ON };
+static TLOCAL int ifsp; /* Stack pointer for the IF stack */
+
+/*  Line store.  The pass 1 line records and, in single-pass mode, the	*/
+/*  results of each source line are kept in growable arrays drawn from	*/
+/*  the heap with realloc().  Source text and object bytes are packed	*/
+/*  into pools and referenced by offset so that the pools can move as	*/
+/*  they grow.  If there's not enough memory to hold the source, a	*/
+/*  fatal error occurs.							*/
+
+static TLOCAL RECORD *records = NULL;
+static TLOCAL LINE *lines = NULL;
+static TLOCAL FIXUP *fixups = NULL;
+static TLOCAL char *text = NULL;
+static TLOCAL unsigned char *code = NULL;
+static TLOCAL unsigned nrecs = 0, nread = 0, nlines = 0, nfixups = 0, ntext = 0, ncode = 0;
+static TLOCAL unsigned maxrecs = 0, maxlines = 0, maxfixups = 0, maxtext = 0, maxcode = 0;
+
+/*  Include fragment store.  The fragments, the symbols they touch, and	*/
+/*  the names of the files they read are kept in growable arrays like	*/
+/*  the line store.  Names are kept in the text pool.			*/
+
+static TLOCAL FRAG *frags = NULL;
+static TLOCAL DEP *deps = NULL;
+static TLOCAL unsigned *fnames = NULL;
+static TLOCAL unsigned nfrags = 0, ndeps = 0, nfnames = 0;
+static TLOCAL unsigned maxfrags = 0, maxdeps = 0, maxfnames = 0;
+static TLOCAL unsigned fragpos; /* The next fragment that pass 2 comes to */
+static TLOCAL unsigned serial; /* Marks the symbols that a fragment has touched */
+static TLOCAL unsigned latedep; /* First symbol touched by a fragment in pass 2 */
+static TLOCAL int fragon; /* Set when fragments are recorded */
+static TLOCAL int reuse; /* Set when fragments may be taken from the build cache */
+static TLOCAL int capturing; /* Set while pass 2 saves the lines of a fragment */
+static TLOCAL int restart; /* Set when a fragment from the build cache is stale */
+
+/*  Pass 2 parts.  The checkpoints that pass 1 keeps are in a growable	*/
+/*  array like the line store.						*/
+
+static TLOCAL CHECK *checks = NULL;
+static TLOCAL unsigned nchecks = 0, maxchecks = 0;
+static TLOCAL PART *part; /* The part this thread assembles, if a pass 2 worker */
+static TLOCAL int ordered; /* Set when pass 2 has to be done in order */
+static TLOCAL int defined; /* Set when a pass 2 worker's line defines its label */
+
+/*  Include pre-scan.  The files to pre-scan are kept in a growable	*/
+/*  array like the line store.						*/
+
+static TLOCAL SCANS prescans;
+static TLOCAL unsigned maxscans = 0;
+static TLOCAL SCAN *scanning; /* The file this thread pre-scans, if a pre-scan worker */
+
+/*  Include prefetch.  The list of files to read is shared with the	*/
+/*  I/O thread, which only adds to it while holding the lock.		*/
+
+static TLOCAL FETCHES prefetches;
+
+#ifndef	A85LIB
+
+/*  Batch mode job list.  The worker threads take the jobs in turn.	*/
+
+static JOB *jobs = NULL;
+static unsigned njobs = 0, nextjob = 0;
+
+#ifdef	PTHREADS
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*  Mainline routine.  With -d, the program becomes an assembler	*/
+/*  server.  With -u, the rest of the command line is handed to the	*/
+/*  server to be run.  Otherwise, the command line is run here.		*/
 
-/*  Mainline routine.  This routine parses the command line, sets up	*/
-/*  the assembler at the beginning of each pass, feeds the source text	*/
-/*  to the line assembler, feeds the result to the listing and hex file	*/
-/*  drivers, and cleans everything up at the end of the run.		*/
 int main(argc,argv)
 int argc;
 char **argv;
 {
-	SCRATCH unsigned *o;
-	int newline(void);
+#ifdef	SERVER
+	SCRATCH char **a, *p;
+
+	for (a = argv + 1; *a; ++a)
+		if (**a == '-' && toupper((*a)[1]) == 'U') {
+			if ((p = sockarg(a,argv + argc))) ask(p,argc,argv);
+			warning(NOCLIENT);
+		}
+	for (a = argv + 1; *a; ++a)
+		if (**a == '-' && toupper((*a)[1]) == 'D') {
+			if ((p = sockarg(a,argv + argc))) serve(p);
+			warning(NOSERVE);
+		}
+#endif
+	exit(run(argc,argv));
+}
+
+/*  Command line routine.  This routine parses the command line, makes	*/
+/*  an assembly job of each source file, runs the jobs, and reports how	*/
+/*  they came out.  With one source file, the return value is the	*/
+/*  number of errors.  In batch mode, it is the number of source files	*/
+/*  that had errors.							*/
 
-	printf("8085 Cross-Assembler (Portable) Ver 0.3\n");
-	printf("Copyright (c) 1985,1987 William C. Colley, III\n");
-	printf("fixes for LCC/Windows (c) 2013 Herb Johnson\n");
-	printf("Glitch Works modifications (c) 2020,2024 Glitch Works, LLC\n\n");
+static char **srcs = NULL, **pres = NULL;
+
+static int run(int argc, char **argv)
+{
+	SCRATCH JOB *j;
+	SCRATCH unsigned i, nsrc, batch;
+	SCRATCH unsigned long u, v;
+	SCRATCH char *p;
+	JOB opts;
+
+	tostderr = to_stdout(argc,argv);
+	fprintf(CONSOLE,"8085 Cross-Assembler (Portable) Ver 0.3\n");
+	fprintf(CONSOLE,"Copyright (c) 1985,1987 William C. Colley, III\n");
+	fprintf(CONSOLE,"fixes for LCC/Windows (c) 2013 Herb Johnson\n");
+	fprintf(CONSOLE,"Glitch Works modifications (c) 2020,2024 Glitch Works, LLC\n\n");
+
+	free(srcs);  free(pres);  free(jobs);
+	jobs = NULL;  njobs = nextjob = 0;
+	a85_init(&opts,NULL);
+	if (!(srcs = malloc(argc * sizeof(char *))) ||
+		!(pres = malloc(argc * sizeof(char *)))) fatal_error(NOMEM);
+	opts.syms = pres;
+	nsrc = batch = 0;
 
 	while (--argc > 0) {
-		if (**++argv == '-') {
+		if (**++argv == '-' && strcmp(*argv,STDNAME)) {
 			switch (toupper(*++*argv)) {
 				case 'L':
 					if (!*++*argv) {
@@ -104,7 +312,8 @@ char **argv;
 						} 
 						else ++argv; 
 					}
-					lopen(*argv);
+					if (opts.lst) warning(TWOLST);
+					else opts.lst = *argv;
 					break;
 
 				case 'O':   
@@ -116,250 +325,981 @@ char **argv;
 						else ++argv;
 					}
 				
-					hopen(*argv);
+					if (opts.hex) warning(TWOHEX);
+					else opts.hex = *argv;
 					break;
 
-				default:    
-					warning(BADOPT);
-			}
-		}
-		else if (filestk[0]) warning(TWOASM);
-		else if (!(filestk[0] = fopen(*argv,"r"))) fatal_error(ASMOPEN);
-	}
+				case 'B':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(NOBIN);
+							break;
+						}
+						else ++argv;
+					}
 
-	if (!filestk[0]) fatal_error(NOASM);
+					if (opts.bin) warning(TWOBIN);
+					else opts.bin = *argv;
+					break;
 
-	while (++pass < 3) {
-		fseek(source = filestk[0],0L,0);  done = off = FALSE;
-		errors = filesp = ifsp = pagelen = pc = 0;  title[0] = '\0';
-	
-		while (!done) {
-			errcode = ' ';
-			if (newline()) {  //reach EOF instead of "END" statement
-				error('*');
-				strcpy(lline,"\tEND\t ;added by A85\n");
-				done = eject = TRUE;  listhex = FALSE;
-				bytes = 0;
-				}
-		
-				else asm_line();
-			pc = word(pc + bytes);
-	
-			if (pass == 2) {
-				if (done) lerror();
-				lputs();
-				for (o = obj; bytes--; hputc(*o++));
-			}
-		}
-	}
+				case 'X':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(NOSREC);
+							break;
+						}
+						else ++argv;
+					}
 
-	fclose(filestk[0]);  lclose();  hclose();
+					if (opts.srec) warning(TWOSREC);
+					else opts.srec = *argv;
+					break;
 
-	if (errors) printf("%d Error(s)\n",errors);
-	else printf("No Errors\n");
+				case 'F':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(BADFILL);
+							break;
+						}
+						else ++argv;
+					}
 
-	exit(errors);
-}
+					if ((u = hexarg(*argv,&p)) > 0xff || *p) warning(BADFILL);
+					else opts.fill = u;
+					break;
 
-static char label[MAXLINE];
+				case 'R':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(BADRANGE);
+							break;
+						}
+						else ++argv;
+					}
 
-static OPCODE *opcod;
+					u = hexarg(*argv,&p);
+					if (*p++ != '-' || (v = hexarg(p,&p)) > 0xffff ||
+						*p || u > v) warning(BADRANGE);
+					else {
+						opts.range = TRUE;
+						opts.rlo = u;  opts.rhi = v;
+					}
+					break;
 
-/*  Line assembly routine.  This routine gets expressions and tokens	*/
-/*  from the source file using the expression evaluator and lexical	*/
-/*  analyzer, respectively.  It fills a buffer with the machine code	*/
-/*  bytes and returns nothing.						*/
-void asm_line(void)
-{
-	SCRATCH char *p;
-	SCRATCH int i;
-	int popc(void);
-	OPCODE *find_code(char *), *find_operator(char *);
+				case 'C':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(NODIR);
+							break;
+						}
+						else ++argv;
+					}
+
+					opts.cache = *argv;
+					break;
 
+				case 'P':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(NOIMG);
+							break;
+						}
+						else ++argv;
+					}
 
+					opts.sym = *argv;
+					break;
 
-	address = pc;  bytes = 0;  eject = forwd = listhex = FALSE;
-	for (i = 0; i < BIGINST; obj[i++] = NOP);
+				case 'S':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(NOPRE);
+							break;
+						}
+						else ++argv;
+					}
+
+					pres[opts.nsyms++] = *argv;
+					break;
+
+				case 'M':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(NODEP);
+							break;
+						}
+						else ++argv;
+					}
+
+					opts.dep = *argv;
+					break;
+
+				case 'W':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(BADREC);
+							break;
+						}
+						else ++argv;
+					}
 
-	label[0] = '\0';
-	if ((i = popc()) != ' ' && i != '\n') {
-		if (isalph((char) i)) { //HRJ
-			pushc(i);  pops(label);
-			/*HRJ need to remove colon from label? */
-			for (p = label; *p; ++p);
-			if (*--p == ':') *p = '\0';
-
-			if (find_operator(label)) { 
-				label[0] = '\0'; 
-				error('L'); 
+					u = isdigit(**argv & 0377) ? strtoul(*argv,&p,10) : 0;
+					if (!u || u > HEXMAX || *p) warning(BADREC);
+					else opts.reclen = u;
+					break;
+
+				case 'J':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(BADJOBS);
+							break;
+						}
+						else ++argv;
+					}
+
+					u = isdigit(**argv & 0377) ? strtoul(*argv,&p,10) : 0;
+					if (!u || u > MAXJOBS || *p) warning(BADJOBS);
+					else batch = u;
+					break;
+
+				case 'T':
+					if (!*++*argv) {
+						if (!--argc) {
+							warning(BADTHREADS);
+							break;
+						}
+						else ++argv;
+					}
+
+					u = isdigit(**argv & 0377) ? strtoul(*argv,&p,10) : 0;
+					if (!u || u > MAXTHREADS || *p) warning(BADTHREADS);
+					else opts.threads = u;
+					break;
+
+				case '1':
+					opts.onepass = TRUE;
+					break;
+
+				case 'V':
+					opts.verbose = TRUE;
+					break;
+
+#ifdef	SERVER
+				case 'D':
+				case 'U':
+					if (!*++*argv && argc > 1) { --argc;  ++argv; }
+					break;
+#endif
+
+				default:    
+					warning(BADOPT);
 			}
 		}
+		else srcs[nsrc++] = *argv;
+	}
 
-		else {
-			error('L');
-			while ((i = popc()) != ' ' && i != '\n');
-		}
+	if (!nsrc) fatal_error(NOASM);
+
+	p = NULL;
+	if (opts.hex && !strcmp(opts.hex,STDNAME)) p = opts.hex;
+	if (opts.bin && !strcmp(opts.bin,STDNAME)) {
+		if (p) { warning(TWOSTD);  opts.bin = NULL; }
+		else p = opts.bin;
+	}
+	if (opts.srec && !strcmp(opts.srec,STDNAME)) {
+		if (p) { warning(TWOSTD);  opts.srec = NULL; }
+		else p = opts.srec;
+	}
+	if (opts.lst && !strcmp(opts.lst,STDNAME) && p) {
+		warning(TWOSTD);  opts.lst = NULL;
 	}
 
-	trash();
-	opcod = NULL;
+	if (!batch) {
+		for (i = 1; i < nsrc; ++i) warning(TWOASM);
+		opts.src = srcs[0];
+		a85_assemble(&opts);
+		if (opts.fatal) fatal_error(opts.fatal);
 
-	if ((i = popc()) != '\n') {
-		if (!isalph((char) i)) error('S');
-		
-		else {
-			pushc(i);  pops(token.sval);
-			if (!(opcod = find_code(token.sval))) error('O');
-		}
-	
-		if (!opcod) { 
-			listhex = TRUE;
-			bytes = BIGINST;
-		}
+		if (errors) fprintf(CONSOLE,"%d Error(s)\n",errors);
+		else fprintf(CONSOLE,"No Errors\n");
+
+		return errors;
 	}
 
-	if (opcod && opcod -> attr & ISIF) { 
-		if (label[0]) error('L');
+	if (!(jobs = malloc(nsrc * sizeof(JOB)))) fatal_error(NOMEM);
+	for (njobs = 0; njobs < nsrc; ++njobs) {
+		j = jobs + njobs;  *j = opts;
+		j -> src = srcs[njobs];
+		if (opts.lst) j -> lst = outname(j -> src,opts.lst);
+		if (opts.hex) j -> hex = outname(j -> src,opts.hex);
+		if (opts.bin) j -> bin = outname(j -> src,opts.bin);
+		if (opts.srec) j -> srec = outname(j -> src,opts.srec);
+		if (opts.sym) j -> sym = outname(j -> src,opts.sym);
+		if (opts.dep) j -> dep = outname(j -> src,opts.dep);
 	}
 
-	else if (off) { /* if off is TRUE, don't process the line */
-		listhex = FALSE;
-		flush();
-		return;
+	run_jobs(batch);
+
+	for (i = 0, j = jobs; j < jobs + njobs; ++j) {
+		if (j -> fatal) fprintf(CONSOLE,"%s: Fatal Error -- %s\n",j -> src,j -> fatal);
+		else if (j -> errors) fprintf(CONSOLE,"%s: %d Error(s)\n",j -> src,j -> errors);
+		else fprintf(CONSOLE,"%s: No Errors\n",j -> src);
+		if (j -> errors) ++i;
 	}
 
-	if (!opcod) { 
-		do_label();
-		flush();
+	for (j = jobs; j < jobs + njobs; ++j) {
+		free(j -> lst);  free(j -> hex);  free(j -> bin);
+		free(j -> srec);  free(j -> sym);  free(j -> dep);
 	}
+	return i;
+}
 
-	else {
-		listhex = TRUE;
-		if (opcod -> attr & PSEUDO) pseudo_op();
-		else normal_op();
-		// HRJ this is where ! operator would be seen
-		while ((i = popc()) != '\n') if (i != ' ') error('T');
+/*  Find out before the command line is parsed whether the listing,	*/
+/*  object, binary, or S-record file is to go to stdout, so that	*/
+/*  everything printed goes to stderr instead.				*/
+
+static int to_stdout(int argc, char **argv)
+{
+	SCRATCH int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-' || !argv[i][1] ||
+			!strchr("LOBX",toupper(argv[i][1]))) continue;
+		if (argv[i][2] ? !strcmp(argv[i] + 2,STDNAME) :
+			i + 1 < argc && !strcmp(argv[++i],STDNAME)) return TRUE;
 	}
+	return FALSE;
+}
 
-	source = filestk[filesp];
-	return;
+/*  Make the name of a batch mode output file by putting the given	*/
+/*  extension in place of the extension of the source file name.  If	*/
+/*  there's not enough memory, a fatal error occurs.			*/
+
+static char *outname(char *src, char *ext)
+{
+	SCRATCH char *p, *q, *n;
+
+	for (p = q = src; *p; ++p)
+		if (*p == '/' || *p == '\\' || *p == ':') q = p + 1;
+	for (p = NULL; *q; ++q) if (*q == '.') p = q;
+	if (!p) p = q;
+
+	if (!(n = malloc((p - src) + strlen(ext) + 2))) fatal_error(NOMEM);
+	memcpy(n,src,p - src);
+	n[p - src] = '.';  strcpy(n + (p - src) + 1,ext);
+	return n;
 }
 
-static void flush(void)
+/*  Batch mode job runner.  Each worker thread takes the next job off	*/
+/*  the list until there are no more, so that a long assembly doesn't	*/
+/*  hold up the rest.  The main thread works too.  Without PTHREADS,	*/
+/*  the jobs are run one after another.					*/
+
+#ifdef	PTHREADS
+static void *worker(void *arg)
 {
-	int popc(void);
+	SCRATCH unsigned i;
+
+	for (;;) {
+		pthread_mutex_lock(&joblock);
+		i = nextjob++;
+		pthread_mutex_unlock(&joblock);
+		if (i >= njobs) return arg;
+		a85_assemble(jobs + i);
+	}
+}
+#endif
 
-	while (popc() != '\n');
+static void run_jobs(unsigned n)
+{
+#ifdef	PTHREADS
+	SCRATCH pthread_t *t;
+	SCRATCH unsigned i, m;
+
+	if (n > njobs) n = njobs;
+	if (!(t = malloc(n * sizeof(pthread_t)))) fatal_error(NOMEM);
+	for (m = 0; m + 1 < n && !pthread_create(t + m,NULL,worker,NULL); ++m);
+	worker(NULL);
+	for (i = 0; i < m; ++i) pthread_join(t[i],NULL);
+	free(t);
+#else
+	for (nextjob = 0; nextjob < njobs; ++nextjob) a85_assemble(jobs + nextjob);
+#endif
 }
 
-static void do_label(void)
+#ifdef	SERVER
+
+/*  Assembler server routine.  The server takes requests on the Unix	*/
+/*  domain socket of the given name, one at a time, for as long as it	*/
+/*  runs.  A request is the client's working directory followed by its	*/
+/*  command line, each string ending in a NUL, and then the end of the	*/
+/*  client's half of the connection.  The command line is run in that	*/
+/*  directory just as if the client had run it, with everything that	*/
+/*  would have been printed sent back to the client instead.  A NUL and	*/
+/*  the exit status in decimal on a line of its own follow.  Files read	*/
+/*  by one request are kept in the warm file cache for the next, and	*/
+/*  the opcode tables never leave memory.  A fatal error ends the	*/
+/*  request rather than the server.  Since a request can write files	*/
+/*  anywhere as the server's owner, only the owner may open the socket	*/
+/*  or have a request taken.  A client that stalls for SERVWAIT	*/
+/*  seconds loses its request, so that it can't hold up the others.	*/
+
+static void serve(char *path)
 {
-	SCRATCH SYMBOL *l;
-	SYMBOL *find_symbol(char *), *new_symbol(char *);
+	struct sockaddr_un sa;
+	struct timeval tv;
+	SCRATCH int s, c, n, out, status;
+	SCRATCH unsigned len, max, argc;
+	SCRATCH char *buf, *p, **argv;
+	SCRATCH mode_t mask;
+	char tail[16];
+	jmp_buf env;
+
+	if (!sockname(&sa,path) || (s = socket(AF_UNIX,SOCK_STREAM,0)) < 0)
+		fatal_error(SOCKOPEN);
+	unlink(path);
+	mask = umask(077);
+	n = bind(s,(struct sockaddr *) &sa,sizeof(sa));
+	umask(mask);
+	if (n || chmod(path,0600) || listen(s,SOMAXCONN)) fatal_error(SOCKOPEN);
+	signal(SIGPIPE,SIG_IGN);
+	printf("Serving on %s\n",path);  fflush(stdout);
+
+	buf = NULL;  max = 0;
+	for (;;) {
+		if ((c = accept(s,NULL,NULL)) < 0) continue;
+		if (!peer_ok(c)) { close(c);  continue; }
+		tv.tv_sec = SERVWAIT;  tv.tv_usec = 0;
+		setsockopt(c,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+		setsockopt(c,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+		len = 0;
+		do {
+			buf = grow(buf,&max,len + BUFSIZ,1);
+			if ((n = read(c,buf + len,BUFSIZ)) > 0) len += n;
+		} while (n > 0 || (n < 0 && errno == EINTR));
+		if (n < 0) len = 0;	/* timed out */
+
+		for (argc = 0, p = buf; p < buf + len; p += strlen(p) + 1) ++argc;
+		argv = (len && !buf[len - 1] && argc > 1) ?
+			malloc(argc * sizeof(char *)) : NULL;
+		if (argv) {
+			p = buf + strlen(buf) + 1;
+			for (n = 0; n < (int) argc - 1; ++n, p += strlen(p) + 1) argv[n] = p;
+			argv[n] = NULL;
+		}
 
-	if (label[0]) {
-		listhex = TRUE;
-	
-		if (pass == 1) {
-			if (!((l = new_symbol(label)) -> attr)) {
-				l -> attr = FORWD + VAL;
-				l -> valu = pc;
-			}
+		fflush(stdout);  out = dup(1);  dup2(c,1);
+		bail = &env;
+		if (setjmp(env)) {
+			printf("Fatal Error -- %s\n",fatal);
+			status = -1;
 		}
-		
 		else {
-			if ((l = find_symbol(label))) {
-				l -> attr = VAL;
-				if (l -> valu != pc) error('M');
+			if (!argv || chdir(buf)) fatal_error(BADREQ);
+			warm_start(buf);
+			status = run(argc - 1,argv);
+		}
+		bail = NULL;  warm_start(NULL);
+		fflush(stdout);  dup2(out,1);  close(out);
+
+		*tail = '\0';  sprintf(tail + 1,"%d\n",status);
+		send_all(c,tail,strlen(tail + 1) + 1);
+		close(c);
+		free(argv);  warm_sweep();
+	}
+}
+
+/*  Assembler client routine.  The command line is sent to the server	*/
+/*  on the Unix domain socket of the given name, what the server prints	*/
+/*  is printed here, and the program exits with the status that the	*/
+/*  server sends back.  The server ignores the -u option.		*/
+
+static void ask(char *path, int argc, char **argv)
+{
+	struct sockaddr_un sa;
+	SCRATCH int s, i, n;
+	SCRATCH unsigned size;
+	SCRATCH char *dir, *p, *q;
+	char buf[BUFSIZ], tail[16];
+
+	for (size = BUFSIZ; (dir = malloc(size)) && !getcwd(dir,size) &&
+		errno == ERANGE; size *= 2) free(dir);
+	if (!dir) fatal_error(NOMEM);
+
+	signal(SIGPIPE,SIG_IGN);
+	if (!sockname(&sa,path) || (s = socket(AF_UNIX,SOCK_STREAM,0)) < 0 ||
+		connect(s,(struct sockaddr *) &sa,sizeof(sa)) ||
+		!send_all(s,dir,strlen(dir) + 1)) fatal_error(NOSERVER);
+	for (i = 0; i < argc; ++i)
+		if (!send_all(s,argv[i],strlen(argv[i]) + 1)) fatal_error(NOSERVER);
+	shutdown(s,SHUT_WR);
+
+	for (q = NULL; (n = read(s,buf,BUFSIZ)) > 0 ||
+		(n < 0 && errno == EINTR); ) {
+		if (n < 0) continue;
+		if (!q) {
+			if (!(p = memchr(buf,'\0',n))) {
+				fwrite(buf,1,n,stdout);  continue;
 			}
-	
-			else error('P');
+			fwrite(buf,1,p - buf,stdout);
+			q = tail;  n -= p - buf + 1;  memmove(buf,p + 1,n);
 		}
+		for (p = buf; p < buf + n && q < tail + sizeof(tail) - 1; ) *q++ = *p++;
 	}
+	if (!q) fatal_error(NOSERVER);
+	*q = '\0';
+	fflush(stdout);
+	exit(atoi(tail));
 }
 
-static void normal_op(void)
+/*  Find the socket name that goes with a -d or -u option, which is	*/
+/*  either the rest of the option or the next argument.  Returns NULL	*/
+/*  if there isn't one.							*/
+
+static char *sockarg(char **a, char **end)
 {
-	SCRATCH unsigned attrib, u;
-	unsigned expr(void);
-	TOKEN *lex(void);
-	void do_label(void), unlex(void);
+	if ((*a)[2]) return *a + 2;
+	return a + 1 < end ? a[1] : NULL;
+}
 
-	do_label();  
-	bytes = (attrib = opcod -> attr) & BYTES;
-	
-	if (pass < 2) return;
+/*  Fill in the socket address for a socket name.  Returns FALSE if	*/
+/*  the name is too long.						*/
 
-	obj[0] = opcod -> valu;  obj[1] = obj[2] = 0;
+static int sockname(struct sockaddr_un *sa, char *path)
+{
+	memset(sa,0,sizeof(*sa));
+	sa -> sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa -> sun_path)) return FALSE;
+	strcpy(sa -> sun_path,path);
+	return TRUE;
+}
 
-	while (attrib & ARG1) {
-		lex();
-	
-		switch (attrib & ARG1) {
-			case DATA_16:   
-				unlex();
-				obj[1] = low(u = expr());
-				obj[2] = high(u);
-				break;
+/*  Returns TRUE if the client on the other end of a connection runs	*/
+/*  as the same user as the server.					*/
 
-			case DATA_8:
-				unlex();
-			
-				if ((u = expr()) > 0xff && u < 0xff80) {
-					error('V');  u = 0;
-				}
-			
-				obj[1] = low(u);
-				break;
+static int peer_ok(int c)
+{
+#ifdef	SO_PEERCRED
+	struct ucred cr;
+	socklen_t n;
+
+	n = sizeof(cr);
+	return !getsockopt(c,SOL_SOCKET,SO_PEERCRED,&cr,&n) && cr.uid == geteuid();
+#else
+	uid_t u;
+	gid_t g;
+
+	return !getpeereid(c,&u,&g) && u == geteuid();
+#endif
+}
 
-			case PORT:
-				unlex();
+/*  Send the whole of a buffer down a socket.  Returns FALSE if it	*/
+/*  can't be sent.							*/
 
-				if ((u = expr()) > 0xff) {
-					error('V');
-					u = 0;
-				}
+static int send_all(int s, char *p, unsigned n)
+{
+	SCRATCH int k;
 
-				obj[1] = low(u);
-				break;
+	while (n) {
+		if ((k = write(s,p,n)) < 0) {
+			if (errno == EINTR) continue;
+			return FALSE;
+		}
+		p += k;  n -= k;
+	}
+	return TRUE;
+}
 
-			case RST_NUM:
-				unlex();
-			
-				if ((u = expr()) > 7) {
-					error('V');
-					u = 0;
-				}
+#endif
 
-				obj[0] |= u << 3;
-				break;
+#endif
 
-			case LDAX_REG:
-				u = BD;
-				goto do_reg;
+/*  Assembly job initialization routine.  The job is set up to		*/
+/*  assemble the named source file with the default options and no	*/
+/*  output.								*/
 
-			case DAD_REG:
-				u = BDHSP;
-				goto do_reg;
+void a85_init(JOB *job, char *src)
+{
+	memset(job,0,sizeof(JOB));
+	job -> src = src;  job -> fill = FILLBYTE;
+}
 
-			case POP_REG:
-				u = BDHPSW;
-				goto do_reg;
+/*  Assembly job routine.  The job's files are opened, the source is	*/
+/*  assembled or its outputs are found in the build cache, and		*/
+/*  everything is cleaned up so that the next job on this thread	*/
+/*  starts fresh.  The build cache isn't used for image buffers,	*/
+/*  diagnostics, or symbol image files.  A fatal error during the job	*/
+/*  abandons the job rather than the program.  The outcome goes in the	*/
+/*  job, and the error count, or -1 after a fatal error, is returned.	*/
 
-			case SRC_REG:
-				token.valu >>= 3;
-				u = BCDEHLMA;
-				goto do_reg;
+int a85_assemble(JOB *job)
+{
+	jmp_buf env, *outer;
 
-			case DST_REG:
-				u = BCDEHLMA;
-			
-			do_reg:			    
-				if ((token.attr & TYPE) != REG) {
-					error('S');  break;
-				}
-			
-				if (!(token.attr & u)) {
+	job -> lo = job -> hi = 0;
+	job -> diags = NULL;  job -> ndiags = maxdiags = 0;
+	curjob = job;
+
+	outer = bail;  bail = &env;  fatal = NULL;
+	if (setjmp(env)) abandon();
+	else {
+		if (job -> text) add_source(job -> src,job -> text,job -> len);
+		if (!open_source(filestk,job -> src)) fatal_error(ASMOPEN);
+		if (job -> image || job -> diag || job -> sym || streams(job)) job -> cache = NULL;
+		if (!job -> cache || !cache_get(job)) {
+			fragon = reuse = job -> cache && !job -> onepass;
+			for (;;) {
+				if (job -> lst) lopen(job -> lst);
+				if (job -> hex) hopen(job -> hex);
+				if (job -> srec) sopen(job -> srec);
+				if (job -> bin) bopen(job -> bin);
+				bfill(job -> fill);
+				if (job -> reclen) hlength(job -> reclen);
+				if (job -> range) brange(job -> rlo,job -> rhi);
+				if (job -> image) bimage(job -> image);
+				onepass = job -> onepass;
+
+				if (do_passes()) break;
+
+				/* A stale fragment was used, so start over without any */
+				abandon();  clear_symbols();  clear_tokens();  clear_lines();
+				reuse = FALSE;
+			}
+
+			if (job -> sym) {
+				if (pcused || pc) warning(SYMPC);
+				else if (errors || !swrite(job -> sym)) warning(SYMNOT);
+			}
+
+			bspan(&job -> lo,&job -> hi);
+			lclose();  hclose();  bclose();
+			if (job -> cache) { keep_frags();  cache_put(job); }
+		}
+		if (job -> dep && !dwrite(job)) warning(DEPNOT);
+	}
+	bail = outer;  curjob = NULL;
+
+	job -> fatal = fatal;
+	job -> errors = fatal ? -1 : (int) errors;
+	close_sources();  clear_symbols();  clear_tokens();  clear_lines();
+	return job -> errors;
+}
+
+/*  Assembly job release routine.  The job's diagnostics go back to the	*/
+/*  heap.  The image buffer belongs to the caller and is left alone.	*/
+
+void a85_release(JOB *job)
+{
+	SCRATCH DIAG *d;
+
+	for (d = job -> diags; d < job -> diags + job -> ndiags; ++d) {
+		free(d -> file);  free(d -> text);
+	}
+	free(job -> diags);
+	job -> diags = NULL;  job -> ndiags = 0;
+}
+
+/*  Returns TRUE if the job reads its source from stdin or writes an	*/
+/*  output file to stdout.  Such jobs don't use the build cache.	*/
+
+static int streams(JOB *job)
+{
+	SCRATCH char **p;
+	char *names[5];
+
+	names[0] = job -> text ? NULL : job -> src;
+	names[1] = job -> lst;  names[2] = job -> hex;  names[3] = job -> bin;
+	names[4] = job -> srec;
+	for (p = names; p < names + 5; ++p)
+		if (*p && !strcmp(*p,STDNAME)) return TRUE;
+	return FALSE;
+}
+
+/*  Assembly pass routine.  This routine sets up the assembler at the	*/
+/*  beginning of each pass, feeds the source text to the line		*/
+/*  assembler, and feeds the result to the listing and hex file		*/
+/*  drivers.  Returns FALSE if the assembly has to be done again	*/
+/*  because an include fragment from the build cache was stale.		*/
+
+static int do_passes(void)
+{
+	SCRATCH unsigned i, *o;
+
+	fragpos = 0;  restart = capturing = watch = ordered = FALSE;
+	if (!onepass && !fragon && curjob -> threads > 1) prescan();
+	prefetch();
+	if (onepass && curjob -> threads > 1) in_order(ORDONE);
+	for (pass = onepass ? 2 : 1; pass < 3; ++pass) {
+		source = filestk;  source -> pos = source -> text;
+		source -> eof = done = off = pcused = FALSE;
+		errors = filesp = ifsp = pagelen = pc = 0;
+		title[0] = '\0';
+		replaying = pass == 2 && !onepass;
+		for (i = 0; i < curjob -> nsyms; ++i) preload(curjob -> syms[i]);
+		if (replaying && parallel()) done = TRUE;
+	
+		while (!done) {
+			assemble();
+	
+			if (onepass) save_line();
+
+			else if (pass == 2) {
+				if (capturing) save_line();
+				if (seeking) { hseek(seekto);  bseek(seekto); }
+				if (bytes && hcheck(bytes)) error('A');
+				if (errcode != ' ' && curjob -> diag) diagnose();
+				if (done) lerror();
+				lputs();
+				for (o = obj; bytes--; ++o) { hputc(*o);  bputc(*o); }
+				if (fragpos < nfrags && frags[fragpos].rec == nread - 1) next_frag();
+				if (off && rec -> skip && !capturing && !curjob -> lst) nread += rec -> skip;
+			}
+
+			else {
+				rec -> text = lline;
+				rec -> tlen = llen;
+			}
+		}
+
+		/* END inside an INCLUDE file ends its fragment too soon to keep it */
+		if (watch) {
+			end_frag();
+			frags[nfrags - 1].state = FRAGBAD;
+		}
+	}
+
+	if (restart) return FALSE;
+
+	if (onepass) {
+		resolve();
+		replay();
+	}
+	return TRUE;
+}
+
+/*  Assemble the next line, or the END line that EOF stands for.	*/
+
+static void assemble(void)
+{
+	errcode = ' ';  seeking = FALSE;
+	if (next_line()) {  //reach EOF instead of "END" statement
+		if (!curjob -> sym) error('*'); /* a header needn't have END */
+		lline = "\tEND\t ;added by A85\n";  llen = strlen(lline);
+		done = eject = TRUE;  listhex = FALSE;
+		bytes = 0;
+	}
+
+	else asm_line();
+	pc = word(pc + bytes);
+}
+
+static TLOCAL char label[MAXLINE];
+
+static TLOCAL OPCODE *opcod;
+
+#ifndef	A85LIB
+
+/*  Convert a hexadecimal command line argument.  The pointer to the	*/
+/*  first character not converted is returned through e.  If there are	*/
+/*  no hex digits, the result is too big to be a byte or an address.	*/
+
+static unsigned long hexarg(char *s, char **e)
+{
+	if (isxdigit(*s & 0377)) return strtoul(s,e,16);
+	*e = s;
+	return 0xffffffffUL;
+}
+
+#endif
+
+/*  Line assembly routine.  This routine gets expressions and tokens	*/
+/*  from the source file using the expression evaluator and lexical	*/
+/*  analyzer, respectively.  It fills a buffer with the machine code	*/
+/*  bytes and returns nothing.  In pass 2, the label and opcode fields	*/
+/*  and the operand tokens come from the line's pass 1 record, except	*/
+/*  that a line that pass 1 passed by in a false IF block is read again	*/
+/*  from its text if the IF comes out the other way in pass 2.		*/
+void asm_line(void)
+{
+	SCRATCH char *p;
+	SCRATCH int i;
+	SCRATCH char name[MAXLINE + 1];
+	SCRATCH int again;
+	int popc(void), skipoff(void);
+	void reread(INPUT *, char *, unsigned);
+	OPCODE *find_code(char *), *find_operator(char *);
+	static TLOCAL INPUT line;
+
+
+
+	address = pc;  bytes = 0;  eject = forwd = listhex = pending = defined = FALSE;
+	for (i = 0; i < BIGINST; obj[i++] = NOP);
+
+	again = FALSE;
+	if (replaying && !off &&
+		(rec -> flags & SKIPPED || (rec -> flags & UNSCANNED && rec -> opcod))) {
+		if (part) part -> fail = TRUE;	/* can't add to the token store */
+		else {
+			reread(&line,rec -> text,rec -> tlen);
+			replaying = FALSE;  again = TRUE;
+		}
+	}
+
+	if (replaying) {
+		strcpy(label,text + rec -> label);  opcod = rec -> opcod;
+		if (rec -> errcode != ' ') error(rec -> errcode);
+		if (rec -> flags & BADOP) {
+			listhex = TRUE;
+			bytes = BIGINST;
+		}
+	}
+
+	else if (off && skipoff()) {	/* nothing in the line but skipped text */
+		listhex = FALSE;
+		if (pass == 1) {
+			rec -> label = save_text("");  rec -> flags |= SKIPPED;
+			if (rec > records && rec[-1].flags & SKIPPED && rec[-1].depth == rec -> depth)
+				++records[runhead].skip;
+			else runhead = rec - records;
+		}
+		return;
+	}
+
+	else {
+		label[0] = '\0';
+		if ((i = popc()) != ' ' && i != '\n') {
+			if (isalph((char) i)) { //HRJ
+				pushc(i);  pops(label);
+				/*HRJ need to remove colon from label? */
+				for (p = label; *p; ++p);
+				if (*--p == ':') *p = '\0';
+
+				if (find_operator(label)) { 
+					label[0] = '\0'; 
+					error('L'); 
+				}
+			}
+
+			else {
+				error('L');
+				while ((i = popc()) != ' ' && i != '\n');
+			}
+		}
+
+		trash();
+		opcod = NULL;
+
+		if ((i = popc()) != '\n') {
+			if (!isalph((char) i)) error('S');
+		
+			else {
+				pushc(i);  pops(name);
+				if (!(opcod = find_code(name))) error('O');
+			}
+	
+			if (!opcod) { 
+				listhex = TRUE;
+				bytes = BIGINST;
+			}
+		}
+
+		if (pass == 1) {
+			rec -> label = save_text(label);  rec -> opcod = opcod;
+			rec -> errcode = errcode;
+			if (bytes) rec -> flags |= BADOP;
+		}
+	}
+
+	if (opcod && opcod -> attr & ISIF) { 
+		if (label[0]) error('L');
+	}
+
+	else if (off) { /* if off is TRUE, don't process the line */
+		listhex = FALSE;
+		flush();
+		return;
+	}
+
+	if (!opcod) { 
+		do_label();
+		flush();
+	}
+
+	else if (replaying && rec -> flags & UNSCANNED) error('P'); /* skipped in pass 1 */
+
+	else {
+		if (replaying) retoken(rec -> tok);
+
+		else {
+			i = tokenize();
+			if (pass == 1) {
+				rec -> tok = i;
+				rec -> flags &= ~UNSCANNED;
+			}
+			if (again) replaying = TRUE;
+		}
+
+		listhex = TRUE;
+		if (opcod -> attr & PSEUDO) pseudo_op();
+		else normal_op();
+		// HRJ this is where ! operator would be seen
+		if (extra()) error('T');
+	}
+
+	if (again) replaying = TRUE;
+	source = filestk + filesp;
+	return;
+}
+
+static void flush(void)
+{
+	void skipline(void);
+
+	if (!replaying) skipline();
+}
+
+/*  Begin the next source line.  Pass 2 takes the line from the pass 1	*/
+/*  records rather than from the source file, and pass 1 starts a new	*/
+/*  record for it.  Returns TRUE once EOF has been reached on the main	*/
+/*  source file.							*/
+
+static int next_line(void)
+{
+	SCRATCH int eof;
+	int newline(void);
+
+	if (replaying) {
+		if (capturing && nread == frags[fragpos].end) end_capture();
+		rec = records + nread++;
+		lline = rec -> text;  llen = rec -> tlen;
+		filesp = rec -> depth;
+		return (rec -> flags & ATEOF) != 0;
+	}
+
+	eof = newline();
+	if (watch && filesp < (int) frags[nfrags - 1].depth) end_frag();
+
+	if (pass == 1) {
+#ifdef	PTHREADS
+		if (curjob -> threads > 1 && !(nrecs % PARTSIZE)) {
+			checks = grow(checks,&maxchecks,nchecks + 1,sizeof(CHECK));
+			checkpoint(checks + nchecks++);
+		}
+#endif
+		records = grow(records,&maxrecs,nrecs + 1,sizeof(RECORD));
+		rec = records + nrecs++;
+		rec -> opcod = NULL;  rec -> lsym = NULL;  rec -> errcode = ' ';
+		rec -> skip = 0;
+		rec -> flags = eof ? ATEOF : UNSCANNED;  rec -> depth = filesp;
+	}
+
+	return eof;
+}
+
+/*  Look up the symbol for the label of the current line.  In pass 2,	*/
+/*  the symbol that pass 1 entered for the label is kept in the line's	*/
+/*  record.  A pass 2 worker can't look a label up.			*/
+
+static SYMBOL *find_label(void)
+{
+	SYMBOL *find_symbol(char *);
+
+	if (replaying && rec -> lsym) return rec -> lsym;
+	if (part) part -> fail = TRUE;
+	return find_symbol(label);
+}
+
+static void do_label(void)
+{
+	SCRATCH SYMBOL *l;
+	SYMBOL *new_symbol(char *);
+
+	if (label[0]) {
+		listhex = TRUE;
+		pcused = TRUE;
+	
+		if (pass == 1) {
+			if (!((l = rec -> lsym = new_symbol(label)) -> attr)) {
+				l -> attr = FORWD + VAL;
+				l -> valu = pc;  l -> def = rec - records;
+			}
+		}
+
+		else if (onepass) {
+			if (!((l = new_symbol(label)) -> attr)) l -> valu = pc;
+			else if (l -> valu != pc) error('M');
+			l -> attr = VAL;
+		}
+		
+		else {
+			if ((l = find_label())) {
+				if (part) defined = TRUE;
+				else l -> attr = VAL;
+				if (l -> valu != pc) error('M');
+			}
+	
+			else error('P');
+		}
+	}
+}
+
+static void normal_op(void)
+{
+	SCRATCH unsigned attrib, m, u;
+	unsigned expr(void);
+	TOKEN *lex(void);
+	void do_label(void), unlex(void);
+
+	do_label();  
+	bytes = (attrib = opcod -> attr) & BYTES;
+	
+	if (pass < 2) return;
+
+	obj[0] = opcod -> valu;  obj[1] = obj[2] = 0;
+
+	while (attrib & ARG1) {
+		m = lmark();
+		lex();
+	
+		switch (attrib & ARG1) {
+			case DATA_16:   
+			case DATA_8:
+			case PORT:
+				unlex();
+				do_operand(attrib & ARG1,m,obj + 1);
+				break;
+
+			case RST_NUM:
+				unlex();
+				do_operand(RST_NUM,m,obj);
+				break;
+
+			case LDAX_REG:
+				u = BD;
+				goto do_reg;
+
+			case DAD_REG:
+				u = BDHSP;
+				goto do_reg;
+
+			case POP_REG:
+				u = BDHPSW;
+				goto do_reg;
+
+			case SRC_REG:
+				token.valu >>= 3;
+				u = BCDEHLMA;
+				goto do_reg;
+
+			case DST_REG:
+				u = BCDEHLMA;
+			
+			do_reg:			    
+				if ((token.attr & TYPE) != REG) {
+					error('S');  break;
+				}
+			
+				if (!(token.attr & u)) {
 					error('R');
 					break;
 				}
@@ -380,46 +1320,44 @@ static void pseudo_op(void)
 {
 	SCRATCH char *s;
 	SCRATCH int c;
-	SCRATCH unsigned *o, u;
+	SCRATCH unsigned *o, m, u;
+	SCRATCH char e;
 	SCRATCH SYMBOL *l;
 	unsigned expr(void);
-	SYMBOL *find_symbol(char *), *new_symbol(char *);
+	SYMBOL *new_symbol(char *);
 	TOKEN *lex(void);
 	void suppress(void);
 
-	int popc(void);
-
 	o = obj;
 
+	/* A pre-scanned file may only hold what comes out the same anywhere */
+	if (scanning && opcod -> valu != DB && opcod -> valu != DS && opcod -> valu != DW) {
+		scanning -> ok = FALSE;
+		return;
+	}
+
 	switch (opcod -> valu) {
 		case DB:
 			do_label();
 			
 			do {
+				m = lmark();
 				switch (lex() -> attr & TYPE) {
 						case SEP:
 							unlex();
-							u = 0;
-							goto save_byte;
+							*o++ = 0;
+							++bytes;
+							break;
 
 						case STR:
-							trash();
-							pushc(c = popc());
-						
-							if (c == ',' || c == '\n') {
+							if ((c = peek()) == SEP || c == EOL) {
 								for (s = token.sval; *s; *o++ = *s++) ++bytes;
 								break;
 							}
 
 						default:
 							unlex();
-							if ((u = expr()) > 0xff && u < 0xff80) {
-								u = 0;
-								error('V');
-							}
-
-						save_byte:
-							*o++ = low(u);
+							do_operand(DB,m,o++);
 							++bytes;
 							break;
 				}
@@ -429,13 +1367,17 @@ static void pseudo_op(void)
 
 		case DS:
 			do_label();
+			if (scanning && !plain(lmark())) scanning -> ok = FALSE;
 			u = word(pc + expr());
 			
 				if (forwd) error('P');
 				
 				else {
 				pc = u;
-				if (pass == 2) hseek(pc);
+				if (pass == 2) {
+					seeking = TRUE;
+					seekto = pc;
+				}
 				}
 				break;
 
@@ -443,13 +1385,14 @@ static void pseudo_op(void)
 			do_label();
 				
 				do {
+				m = lmark();
 				lex();
 				unlex();
 				
-				u = ((token.attr & TYPE) == SEP) ? 0 : expr();
+				if ((token.attr & TYPE) == SEP) put_value(DW,0,o);
+				else do_operand(DW,m,o);
 			
-				*o++ = low(u);
-				*o++ = high(u);
+				o += 2;
 				bytes += 2;
 
 				} while ((lex() -> attr & TYPE) == SEP);
@@ -459,6 +1402,8 @@ static void pseudo_op(void)
 		case ELSE:
 			if (ifsp) {
 				/* IF stack not empty, see if we're turning assembly on or off */
+				if (watch && ifsp <= (int) frags[nfrags - 1].ifsp)
+					frags[nfrags - 1].state = FRAGBAD;
 				off = (ifstack[ifsp] = -ifstack[ifsp]) != ASM_ON;
 			} else {
 				listhex = FALSE; /* Don't print anything in address column */
@@ -484,9 +1429,12 @@ static void pseudo_op(void)
 				done = eject = TRUE;
 			
 				if (pass == 2) {
+						m = lmark();  e = errcode;
 						if ((lex() -> attr & TYPE) != EOL) {
 						unlex();
-						hseek(address = expr());
+						seekto = address = expr();
+						seeking = TRUE;
+						if (pending) defer(END,m,e,obj);
 						}
 				}
 				
@@ -500,6 +1448,8 @@ static void pseudo_op(void)
 			
 			if (ifsp) {
 				/* IF stack not empty, see if we're turning assembly on or off */
+				if (watch && ifsp <= (int) frags[nfrags - 1].ifsp)
+					frags[nfrags - 1].state = FRAGBAD;
 				off = ifstack[--ifsp] != ASM_ON;
 			} else error('I');
 			
@@ -508,24 +1458,42 @@ static void pseudo_op(void)
 		case EQU:
 			if (label[0]) {
 				if (pass == 1) {
-						if (!((l = new_symbol(label)) -> attr)) {
-						l -> attr = FORWD + VAL;
+						if (!((l = rec -> lsym = new_symbol(label)) -> attr)) {
+						l -> attr = FORWD + VAL;  l -> def = rec - records;
 						address = expr();
 				
 						if (!forwd) l -> valu = address;
 						}
 				}
-				
-				else {
-						if ((l = find_symbol(label))) {
-						l -> attr = VAL;
+
+				else if (onepass) {
+						l = new_symbol(label);
+						m = lmark();  e = errcode;
 						address = expr();
-						
+
 						if (forwd) error('P');
-						
-						if (l -> valu != address) error('M');
+						if (pending) defer(EQU,m,e,obj);
+
+						if (!l -> attr) {
+						if (!forwd) l -> valu = address;
 						}
-						
+
+						else if (l -> valu != address) error('M');
+
+						l -> attr = VAL;
+				}
+				
+				else {
+						if ((l = find_label())) {
+						if (part) defined = TRUE;
+						else l -> attr = VAL;
+						address = expr();
+						
+						if (forwd) error('P');
+						
+						if (l -> valu != address) error('M');
+						}
+						
 						else error('P');
 				}
 			}
@@ -569,7 +1537,7 @@ static void pseudo_op(void)
 				ifstack[ifsp] = ASM_NULL; /* Set IF stack value to NULL state */
 			} else {
 				if (token.attr == VAL) {
-					if (find_symbol(token.sval) && !forwd) {
+					if (token.sym && !forwd) {
 						address = token.valu; /* Show defined symbol value as address */
 						ifstack[ifsp] = ASM_ON; /* Push assembly state to IF stack */
 						off = FALSE; /* Switch assembly ON for this block */
@@ -599,7 +1567,7 @@ static void pseudo_op(void)
 				ifstack[ifsp] = ASM_NULL; /* Set IF stack value to NULL state */
 			} else {
 				if (token.attr == VAL) {
-					if (find_symbol(token.sval) && !forwd) {
+					if (token.sym && !forwd) {
 						address = token.valu; /* Show defined symbol as address */
 						ifstack[ifsp] = ASM_OFF; /* Push assembly state to IF stack */
 						off = TRUE;	/* Switch assembly OFF for this block */
@@ -621,11 +1589,38 @@ static void pseudo_op(void)
 			do_label();
 			
 			if ((lex() -> attr & TYPE) == STR) {
-				if (++filesp == FILES) fatal_error(FLOFLOW);
+				if (replaying) {
+					if (rec -> flags & INCFAIL) error('V');
+					else if (rec -> flags & SYMIMG) inc_syms(token.sval);
+				}
+
+				else if (!filesp && use_scan(token.sval));	/* pre-scanned */
+
+				else {
+					if (++filesp == FILES) fatal_error(FLOFLOW);
+					fetched(token.sval);
 			
-				if (!(filestk[filesp] = fopen(token.sval,"r"))) {
-					--filesp;
-					error('V');
+					if (!open_source(filestk + filesp,token.sval)) {
+						--filesp;
+						error('V');
+						if (pass == 1) rec -> flags |= INCFAIL;
+						if (watch) note_file(token.sval);
+					}
+
+					else if (is_syms(filestk + filesp)) {
+						--filesp;
+						inc_syms(token.sval);
+					}
+
+					/* An INCLUDE from the main source is a fragment */
+					else if (watch) note_file(token.sval);
+					else if (fragon && filesp == 1) {
+						if (reuse && use_frag(token.sval)) {
+							--filesp;
+							rec -> flags |= REUSED;
+						}
+						else new_frag(token.sval);
+					}
 				}
 			}
 			
@@ -638,7 +1633,10 @@ static void pseudo_op(void)
 			
 			else {
 				pc = address = u;
-				if (pass == 2) hseek(pc);
+				if (pass == 2) {
+					seeking = TRUE;
+					seekto = pc;
+				}
 			}
 			
 			do_label();
@@ -666,14 +1664,15 @@ static void pseudo_op(void)
 
 			if ((lex() -> attr & TYPE) != STR) error('S');
 
-			if (pass == 1) printf("%s\n", token.sval);
+			if (pass == 1 || onepass) say(token.sval);
 
 			break;
 
 		case SET:   
 			if (label[0]) {
 				if (pass == 1) {
-					if (!((l = new_symbol(label)) -> attr) || (l -> attr & SOFT)) {
+					ordered = TRUE;	/* a worker can't change a value */
+					if (!((l = rec -> lsym = new_symbol(label)) -> attr) || (l -> attr & SOFT)) {
 						l -> attr = FORWD + SOFT + VAL;
 						address = expr();
 					
@@ -681,12 +1680,16 @@ static void pseudo_op(void)
 					}
 				}
 				else {
-					if ((l = find_symbol(label))) {
+					if ((l = find_label()) || (onepass && (l = new_symbol(label)))) {
+						m = lmark();  e = errcode;
 						address = expr();
 						
-						if (forwd) error('P');
+						if (forwd) {
+							error('P');
+							if (pending) defer(EQU,m,e,obj);
+						}
 				
-						else if (l -> attr & SOFT) {
+						else if (!l -> attr || l -> attr & SOFT) {
 							l -> attr = SOFT + VAL;
 							l -> valu = address;
 						}
@@ -716,3 +1719,1410 @@ static void pseudo_op(void)
 	}
 	return;
 }
+
+/*  Operand evaluation routine.  The expression at the current point in	*/
+/*  the source line is evaluated and dropped into the object buffer as	*/
+/*  the given kind of operand.  In single-pass mode, an expression that	*/
+/*  refers to a symbol not yet defined is left for resolve() to patch.	*/
+/*  The flag pending covers every token lexed since the last operand.	*/
+/*  The mark is the offset of the expression in the source line.	*/
+
+static void do_operand(unsigned kind, unsigned mark, unsigned *o)
+{
+	SCRATCH unsigned u;
+	SCRATCH char e;
+	unsigned expr(void);
+
+	e = errcode;
+	u = expr();
+
+	if (pending) {
+		defer(kind,mark,e,o);
+		pending = FALSE;
+	}
+
+	else put_value(kind,u,o);
+}
+
+static void put_value(unsigned kind, unsigned u, unsigned *o)
+{
+	switch (kind) {
+		case DATA_8:
+		case DB:
+			if (u > 0xff && u < 0xff80) {
+				error('V');  u = 0;
+			}
+
+			*o = low(u);
+			break;
+
+		case PORT:
+			if (u > 0xff) {
+				error('V');  u = 0;
+			}
+
+			*o = low(u);
+			break;
+
+		case RST_NUM:
+			if (u > 7) {
+				error('V');  u = 0;
+			}
+
+			*o |= u << 3;
+			break;
+
+		case DATA_16:
+		case DW:
+			*o++ = low(u);
+			*o = high(u);
+			break;
+	}
+}
+
+/*  Growable array allocation.  The array is doubled in size until it	*/
+/*  holds at least need elements.  If there's not enough memory, a	*/
+/*  fatal error occurs.							*/
+
+void *grow(void *p, unsigned *max, unsigned need, unsigned size)
+{
+	if (need > *max) {
+		while (need > *max) *max = *max ? *max * 2 : 1024;
+		if (!(p = realloc(p,(size_t) *max * size))) fatal_error(LINES);
+	}
+	return p;
+}
+
+/*  Line store teardown routine.  Everything goes back to the heap.	*/
+
+static void clear_lines(void)
+{
+	free(records);  free(lines);  free(fixups);  free(text);  free(code);
+	records = NULL;  lines = NULL;  fixups = NULL;  text = NULL;  code = NULL;
+	nrecs = nread = nlines = nfixups = ntext = ncode = 0;
+	maxrecs = maxlines = maxfixups = maxtext = maxcode = 0;
+	free(checks);  checks = NULL;  nchecks = maxchecks = 0;
+	clear_frags();  stop_fetch();  clear_scans();
+}
+
+static unsigned save_text(char *s)
+{
+	SCRATCH unsigned n;
+
+	n = strlen(s) + 1;
+	text = grow(text,&maxtext,ntext + n,1);
+	memcpy(text + ntext,s,n);
+	return (ntext += n) - n;
+}
+
+/*  Queue a fixup for an operand of the line being assembled.  The	*/
+/*  error code is the line's as the operand began.			*/
+
+static void defer(unsigned kind, unsigned mark, char err, unsigned *o)
+{
+	SCRATCH FIXUP *f;
+
+	fixups = grow(fixups,&maxfixups,nfixups + 1,sizeof(FIXUP));
+	f = fixups + nfixups++;
+	f -> kind = kind;  f -> line = nlines;  f -> mark = mark;
+	f -> byte = o - obj;  f -> pc = pc;  f -> errcode = err;
+}
+
+/*  Save the line just assembled.  This takes the place of the listing	*/
+/*  and hex file output done by the main routine in pass 2.		*/
+
+static void save_line(void)
+{
+	SCRATCH LINE *l;
+	SCRATCH unsigned i;
+
+	lines = grow(lines,&maxlines,nlines + 1,sizeof(LINE));
+	l = lines + nlines++;
+	l -> text = lline;  l -> tlen = llen;
+	l -> address = address;  l -> seek = seekto;  l -> errcode = errcode;
+	l -> flags = (listhex ? LISTHEX : 0) | (eject ? EJECT : 0) |
+		(seeking ? SEEK : 0) | (defined ? DEFINED : 0);
+
+	if (opcod && (opcod -> attr & PSEUDO) &&
+		(opcod -> valu == PAGE || opcod -> valu == TITLE)) {
+		l -> flags |= NEWPAGE;
+		l -> pagelen = pagelen;  l -> title = save_title();
+	}
+
+	code = grow(code,&maxcode,ncode + bytes,1);
+	l -> code = ncode;  l -> bytes = bytes;
+	for (i = 0; i < bytes; code[ncode++] = obj[i++]);
+}
+
+/*  Fixup resolution routine.  Every symbol is now known, so each	*/
+/*  queued operand is re-read from its stored tokens and evaluated	*/
+/*  just as pass 2 would have, and the result is patched into the saved	*/
+/*  object code.  Errors are charged to the line the operand came from.	*/
+/*  Except for EQU, the operand's first token is handed out and pushed	*/
+/*  back before the expression is evaluated, as the line assembler	*/
+/*  does.  The line's error code is worked out again from where it	*/
+/*  stood as the operand began, so that an error found now comes ahead	*/
+/*  of one that the first try found later in the line.			*/
+
+static void resolve(void)
+{
+	SCRATCH FIXUP *f;
+	SCRATCH LINE *l, *prev;
+	SCRATCH unsigned i, n, u;
+	SCRATCH char now, old, was;
+	unsigned expr(void);
+	TOKEN *lex(void);
+	void unlex(void);
+
+	onepass = FALSE;
+	for (prev = NULL, now = old = ' ', f = fixups; f < fixups + nfixups; ++f) {
+		l = lines + f -> line;
+		if (l != prev) { prev = l;  old = l -> errcode;  now = ' '; }
+		errcode = was = now != ' ' ? now : f -> errcode;  pc = f -> pc;
+		retoken(f -> mark);
+		if (f -> kind != EQU) { lex();  unlex(); }
+		u = expr();
+
+		if (f -> kind == END) l -> seek = l -> address = u;
+
+		else if (f -> kind == EQU) l -> address = u;
+
+		else {
+			n = (f -> kind == DATA_16 || f -> kind == DW) ? 2 : 1;
+			for (i = 0; i < n; ++i) obj[i] = code[l -> code + f -> byte + i];
+			put_value(f -> kind,u,obj);
+			for (i = 0; i < n; ++i) code[l -> code + f -> byte + i] = obj[i];
+		}
+
+		if (was == ' ' && errcode != ' ' && old != ' ') --errors;	/* counted once */
+		now = errcode;
+		l -> errcode = now != ' ' ? now : old;
+	}
+	onepass = TRUE;
+}
+
+/*  Replay the saved lines into the listing and hex file drivers in the	*/
+/*  same way that the main routine does in pass 2.			*/
+
+static void replay(void)
+{
+	SCRATCH LINE *l;
+
+	pagelen = 0;  title[0] = '\0';
+	for (l = lines; l < lines + nlines; ++l) put_line(l,l == lines + nlines - 1);
+}
+
+/*  Put a saved line out.  The last line of the source gets the error	*/
+/*  count.								*/
+
+static void put_line(LINE *l, int last)
+{
+	SCRATCH unsigned i, *o;
+
+	lline = l -> text;  llen = l -> tlen;
+	errcode = l -> errcode;  address = l -> address;
+	listhex = (l -> flags & LISTHEX) != 0;
+	eject = (l -> flags & EJECT) != 0;
+
+	if (l -> flags & NEWPAGE) {
+		pagelen = l -> pagelen;
+		strcpy(title,text + l -> title);
+	}
+
+	for (i = 0; i < l -> bytes; ++i) obj[i] = code[l -> code + i];
+	bytes = l -> bytes;
+
+	if (l -> flags & SEEK) { hseek(l -> seek);  bseek(l -> seek); }
+	if (bytes && hcheck(bytes)) error('A');
+	if (errcode != ' ' && curjob -> diag) diagnose();
+	if (last) lerror();
+	lputs();
+	for (o = obj; bytes--; ++o) { hputc(*o);  bputc(*o); }
+}
+
+/*  Save the title for the line just assembled.  A pass 2 worker keeps	*/
+/*  its titles with its part, since the text pool isn't its own.	*/
+
+static unsigned save_title(void)
+{
+	SCRATCH unsigned n;
+
+	if (!part) return save_text(title);
+	n = strlen(title) + 1;
+	part -> titles = grow(part -> titles,&part -> maxtitles,part -> ntitles + n,1);
+	memcpy(part -> titles + part -> ntitles,title,n);
+	return (part -> ntitles += n) - n;
+}
+
+/*  Pass 2 in parts.  If the job asks for threads and pass 1 left more	*/
+/*  than one checkpoint, pass 2 is split into a part for each thread.	*/
+/*  Once the workers are done, each part's lines are sent out as	*/
+/*  put_line() does for single-pass mode.  Returns FALSE, having sent	*/
+/*  nothing out, if pass 2 has to be done in order:  SET may change a	*/
+/*  value and a symbol image may add symbols as pass 2 goes, so they	*/
+/*  and include fragments are left to the main routine, as is a part	*/
+/*  that didn't start in the state the part before it ended in.  With	*/
+/*  -v, the reason is reported.						*/
+
+static int parallel(void)
+{
+#ifdef	PTHREADS
+	SCRATCH PART *p, *parts;
+	SCRATCH LINE *l;
+	SCRATCH unsigned char *own;
+	SCRATCH unsigned n;
+	SCRATCH char *why;
+
+	if (curjob -> threads < 2) return FALSE;
+	if ((n = curjob -> threads) > nchecks) n = nchecks;
+	if (n < 2) return in_order(ORDSHORT);
+	if (ordered) return in_order(ORDSET);
+	if (fragon) return in_order(ORDCACHE);
+	if (!(parts = calloc(n,sizeof(PART)))) return FALSE;
+
+	link_tokens(&parts -> tokens);
+	for (p = parts; p < parts + n; ++p) {
+		if (p == parts) checkpoint(&p -> start);	/* as pass 2 starts */
+		else p -> start = checks[(p - parts) * nchecks / n];
+		p -> last = p + 1 < parts + n ? checks[(p + 1 - parts) * nchecks / n].rec : nrecs;
+		p -> job = curjob;  p -> records = records;  p -> text = text;
+		p -> tokens = parts -> tokens;
+		p -> started = !pthread_create(&p -> thread,NULL,assemble_part,p);
+	}
+
+	for (why = NULL, p = parts; p < parts + n; ++p) {
+		if (p -> started) pthread_join(p -> thread,NULL);
+		if (why) continue;
+		if (!p -> started) why = ORDTHREAD;
+		else if (p -> fail) why = ORDFAIL;
+		else if (p -> done != (p + 1 == parts + n) ||
+			(p > parts && !agree(&p[-1].end,&p -> start))) why = ORDSTEP;
+	}
+
+	if (!why) {
+		for (p = parts; p < parts + n; ++p) {
+			errors += p -> errors;
+			if (p -> pcused) pcused = TRUE;
+		}
+
+		own = code;
+		for (p = parts; p < parts + n; ++p) {
+			code = p -> code;
+			for (l = p -> lines; l < p -> lines + p -> nlines; ++l) {
+				if (l -> flags & DEFINED)
+					records[p -> start.rec + (l - p -> lines)].lsym -> attr = VAL;
+				if (l -> flags & NEWPAGE) l -> title = save_text(p -> titles + l -> title);
+				put_line(l,p + 1 == parts + n && l + 1 == p -> lines + p -> nlines);
+			}
+		}
+		code = own;
+		resume(&parts[n - 1].end);
+	}
+
+	for (p = parts; p < parts + n; ++p) {
+		free(p -> lines);  free(p -> code);  free(p -> titles);
+	}
+	free(parts);
+	return why ? in_order(why) : TRUE;
+#else
+	return curjob -> threads > 1 ? in_order(ORDNONE) : FALSE;
+#endif
+}
+
+/*  Report why pass 2 is done in order, if the job asks.  Returns	*/
+/*  FALSE for parallel() to pass on.					*/
+
+static int in_order(char *why)
+{
+	char msg[MAXLINE + 1];
+
+	if (curjob -> verbose) {
+		sprintf(msg,"%.*s: Pass 2 Done in Order -- %s",MAXLINE / 2,curjob -> src,why);
+		say(msg);
+	}
+	return FALSE;
+}
+
+/*  Console message routine.  The message is printed as a line of its	*/
+/*  own.  The library prints nothing, but hands the message to the	*/
+/*  job's print routine, if it has one.					*/
+
+void say(char *msg)
+{
+#ifdef	A85LIB
+	if (curjob && curjob -> print) (*curjob -> print)(msg);
+#else
+	fprintf(CONSOLE,"%s\n",msg);
+#endif
+	return;
+}
+
+/*  Returns TRUE if a symbol is still a forward reference on the line	*/
+/*  that a pass 2 worker is assembling.  Each part is checked to define	*/
+/*  every label on the line that pass 1 first defined it on, so that is	*/
+/*  where the symbol stops being one.					*/
+
+int later(SYMBOL *s)
+{
+	SCRATCH unsigned r;
+
+	r = rec - records;
+	return s -> def > r || (s -> def == r && !defined);
+}
+
+#ifdef	PTHREADS
+
+/*  Pass 2 worker thread.  The part's lines are assembled from the pass	*/
+/*  1 records into a line store of the thread's own, starting in the	*/
+/*  state that pass 1 was in at the part's checkpoint.  A fatal error	*/
+/*  fails the part, so that pass 2 is done over in order to report it.	*/
+
+static void *assemble_part(void *arg)
+{
+	SCRATCH PART *p;
+	SCRATCH SYMBOL *s;
+	jmp_buf env;
+
+	p = part = arg;
+	curjob = p -> job;  records = p -> records;  text = p -> text;
+	use_tokens(&p -> tokens);
+	resume(&p -> start);
+	pass = 2;  replaying = TRUE;  nread = p -> start.rec;
+
+	bail = &env;
+	if (setjmp(env)) p -> fail = TRUE;
+	else while (!done && !p -> fail && nread < p -> last) {
+		assemble();
+		if ((s = rec -> lsym) && s -> attr & FORWD && s -> def == (unsigned) (rec - records) &&
+			!defined) p -> fail = TRUE;
+		save_line();
+	}
+
+	checkpoint(&p -> end);
+	p -> lines = lines;  p -> nlines = nlines;  p -> code = code;
+	p -> errors = errors;  p -> pcused = pcused;  p -> done = done;
+	lines = NULL;  code = NULL;  records = NULL;  text = NULL;
+	use_tokens(NULL);
+	bail = NULL;  part = NULL;  curjob = NULL;
+	return arg;
+}
+
+/*  Checkpoint routines.  The state that carries the line assembler	*/
+/*  from one line to the next is kept, put back, or compared.		*/
+
+static void checkpoint(CHECK *c)
+{
+	c -> rec = replaying ? nread : nrecs;
+	c -> pc = pc;  c -> pagelen = pagelen;
+	c -> off = off;  c -> ifsp = ifsp;
+	memcpy(c -> ifstack,ifstack,sizeof(ifstack));
+	strcpy(c -> title,title);
+}
+
+static void resume(CHECK *c)
+{
+	pc = c -> pc;  pagelen = c -> pagelen;
+	off = c -> off;  ifsp = c -> ifsp;
+	memcpy(ifstack,c -> ifstack,sizeof(ifstack));
+	strcpy(title,c -> title);
+}
+
+static int agree(CHECK *a, CHECK *b)
+{
+	return a -> rec == b -> rec && a -> pc == b -> pc &&
+		a -> pagelen == b -> pagelen && a -> off == b -> off &&
+		a -> ifsp == b -> ifsp &&
+		!memcmp(a -> ifstack,b -> ifstack,(a -> ifsp + 1) * sizeof(int)) &&
+		!strcmp(a -> title,b -> title);
+}
+
+#endif
+
+/*  Include pre-scan.  The files named by INCLUDE lines of the main	*/
+/*  source are handed to worker threads, which run pass 1 over each of	*/
+/*  them on its own.  A file comes out of it ok if every line is an	*/
+/*  instruction, DB, DW, or DS of a number, so that only the values of	*/
+/*  its labels depend on where it is INCLUDEd.  Pass 1 then takes the	*/
+/*  file's records from its pre-scan rather than reading it.		*/
+
+static void prescan(void)
+{
+#ifdef	PTHREADS
+	SCRATCH unsigned i, n;
+	SCRATCH SCAN *s;
+	SCRATCH char *p;
+	pthread_t threads[MAXTHREADS];
+	char name[MAXLINE + 1];
+
+	for (p = filestk -> text; (p = next_inc(p,filestk -> end,name)); ) {
+		for (s = prescans.scans; s < prescans.scans + prescans.nscans; ++s)
+			if (!strcmp(s -> file.name,name)) break;
+		if (s < prescans.scans + prescans.nscans) continue;
+		prescans.scans = grow(prescans.scans,&maxscans,prescans.nscans + 1,sizeof(SCAN));
+		s = prescans.scans + prescans.nscans++;
+		memset(s,0,sizeof(SCAN));
+		s -> file.name = copy(name,strlen(name));
+	}
+
+	if ((n = curjob -> threads) > prescans.nscans) n = prescans.nscans;
+	if (!n) return;
+
+	prescans.next = 0;
+	pthread_mutex_init(&prescans.lock,NULL);
+	for (i = 0; i < n && !pthread_create(threads + i,NULL,scan_files,&prescans); ++i);
+	while (i) pthread_join(threads[--i],NULL);
+	pthread_mutex_destroy(&prescans.lock);
+#endif
+}
+
+#ifdef	PTHREADS
+
+/*  Find the next INCLUDE line in the text from p to end, which has a	*/
+/*  newline after it.  The name of the file is copied to nam, and the	*/
+/*  start of the line after is returned, or NULL if there are no more.	*/
+/*  The raw text is looked at rather than lexed, so a line in a comment	*/
+/*  or a false IF block may name a file too.  A file that pass 1 never	*/
+/*  comes to is only read or pre-scanned for nothing.			*/
+
+static char *next_inc(char *p, char *end, char *nam)
+{
+	SCRATCH char *q, *e;
+	SCRATCH OPCODE *o;
+	char c;
+	OPCODE *find_code(char *);
+
+	for (; p < end; p = e + 1) {
+		e = memchr(p,'\n',end - p + 1);
+		if (*p == ';') continue;
+		while (p < e && *p != ' ' && *p != '\t' && *p != ';') ++p;
+		while (p < e && (*p == ' ' || *p == '\t')) ++p;
+		for (q = p; q < e && isalph(*q) && q - p < MAXLINE; ++q);
+		memcpy(nam,p,q - p);  nam[q - p] = '\0';
+		if (!(o = find_code(nam)) || !(o -> attr & PSEUDO) || o -> valu != INCL)
+			continue;
+
+		for (p = q; p < e && (*p == ' ' || *p == '\t'); ++p);
+		if (p == e || ((c = *p++) != '"' && c != '\'')) continue;
+		if (!(q = memchr(p,c,e - p)) || q - p > MAXLINE) continue;
+		memcpy(nam,p,q - p);  nam[q - p] = '\0';
+		return e + 1;
+	}
+	return NULL;
+}
+
+/*  Pre-scan worker thread.  Files are taken in turn until there are	*/
+/*  none left.								*/
+
+static void *scan_files(void *arg)
+{
+	SCRATCH SCANS *ss;
+	SCRATCH SCAN *s;
+
+	for (ss = arg;;) {
+		pthread_mutex_lock(&ss -> lock);
+		s = ss -> next < ss -> nscans ? ss -> scans + ss -> next++ : NULL;
+		pthread_mutex_unlock(&ss -> lock);
+		if (!s) return arg;
+		scan_file(s);
+	}
+}
+
+/*  Pre-scan a file.  The file is read and assembled by pass 1 as if it	*/
+/*  were the main source, starting from $ = 0.  The records, text pool,	*/
+/*  and tokens are kept with the file if it comes out ok, and dropped	*/
+/*  along with the thread's symbols otherwise.  The record of the END	*/
+/*  that EOF stands for isn't kept.  A fatal error just leaves the file	*/
+/*  for pass 1 to read, which will report it.				*/
+
+static void scan_file(SCAN *s)
+{
+	SCRATCH unsigned start;
+	SOURCE lent;
+	jmp_buf env;
+	JOB job;
+
+	a85_init(&job,s -> file.name);
+	curjob = &job;  scanning = s;
+	bail = &env;
+	if (setjmp(env)) s -> ok = FALSE;
+	else if (fetch_source(&s -> file)) {
+		lent = s -> file;  lent.warm = TRUE;	/* the text stays with the scan */
+		give_source(&lent);
+		open_source(filestk,s -> file.name);
+		s -> ok = !is_syms(filestk);
+
+		pass = 1;  source = filestk;
+		done = off = pcused = replaying = FALSE;
+		errors = filesp = ifsp = pagelen = pc = 0;
+		title[0] = '\0';
+		while (!done && s -> ok) {
+			start = pc;
+			assemble();
+			rec -> text = lline;
+			rec -> tlen = llen;
+			s -> offs = grow(s -> offs,&s -> maxoffs,nrecs,sizeof(unsigned));
+			s -> offs[nrecs - 1] = start;
+		}
+
+		if (s -> ok && rec -> flags & ATEOF) {
+			s -> records = records;  s -> nrecs = nrecs - 1;
+			s -> text = text;  s -> size = pc;
+			take_tokens(&s -> tokens);
+			records = NULL;  text = NULL;
+		}
+		else s -> ok = FALSE;
+	}
+
+	clear_lines();  clear_tokens();  clear_symbols();  close_sources();
+	bail = NULL;  scanning = NULL;  curjob = NULL;
+}
+
+#endif
+
+/*  Take the lines of an INCLUDEd file from its pre-scan.  The records	*/
+/*  are added to pass 1's as they are, but for where their labels and	*/
+/*  tokens now are, and a checkpoint is kept wherever next_line() would	*/
+/*  have kept one.  Each label is entered as do_label() would have, at	*/
+/*  its offset from $.  Returns FALSE if the file wasn't pre-scanned,	*/
+/*  didn't come out ok, or is already in the source cache with other	*/
+/*  text, in which case pass 1 reads it.				*/
+
+static int use_scan(char *nam)
+{
+#ifdef	PTHREADS
+	SCRATCH SCAN *s;
+	SCRATCH RECORD *p, *q;
+	SCRATCH SYMBOL *l;
+	SCRATCH unsigned base, first, i, r;
+	SYMBOL *new_symbol(char *);
+
+	for (s = prescans.scans; s < prescans.scans + prescans.nscans; ++s)
+		if (!strcmp(s -> file.name,nam)) break;
+	if (s == prescans.scans + prescans.nscans || !s -> ok || !give_source(&s -> file))
+		return FALSE;
+	s -> taken = TRUE;
+
+	r = rec - records;  base = pc;
+	first = add_tokens(&s -> tokens);
+	for (i = 0; i < s -> nrecs; ++i) {
+		pc = word(base + s -> offs[i]);
+		if (curjob -> threads > 1 && !(nrecs % PARTSIZE)) {
+			checks = grow(checks,&maxchecks,nchecks + 1,sizeof(CHECK));
+			checkpoint(checks + nchecks++);
+		}
+		records = grow(records,&maxrecs,nrecs + 1,sizeof(RECORD));
+		p = s -> records + i;  q = records + nrecs++;
+		*q = *p;
+		q -> label = save_text(s -> text + p -> label);
+		q -> tok = p -> tok + first;  q -> depth = 1;  q -> lsym = NULL;
+		if (p -> lsym && !((l = q -> lsym = new_symbol(text + q -> label)) -> attr)) {
+			l -> attr = FORWD + VAL;
+			l -> valu = pc;  l -> def = q - records;
+		}
+	}
+
+	pc = word(base + s -> size);
+	rec = records + r;
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/*  Pre-scan teardown routine.  Everything goes back to the heap but	*/
+/*  the text of files that were handed to the source cache.		*/
+
+static void clear_scans(void)
+{
+	SCRATCH SCAN *s;
+
+	for (s = prescans.scans; s < prescans.scans + prescans.nscans; ++s) {
+		free(s -> file.name);
+		if (!s -> taken && !s -> file.warm) free(s -> file.text);
+		free(s -> records);  free(s -> offs);  free(s -> text);
+		free(s -> tokens.toks);  free(s -> tokens.strs);
+	}
+	free(prescans.scans);
+	prescans.scans = NULL;  prescans.nscans = maxscans = 0;
+}
+
+/*  Include prefetch routines.  Before pass 1, the I/O thread is given	*/
+/*  the files named by INCLUDE lines of the main source.  With a	*/
+/*  pre-scan, it is given those that the pre-scan didn't read, and	*/
+/*  those INCLUDEd by files that didn't come out ok.  The files that	*/
+/*  the pre-scan did read are already in memory, so they are listed as	*/
+/*  claimed for the thread to pass by.  Each file the thread reads is	*/
+/*  looked at for INCLUDE lines in turn.				*/
+
+static void prefetch(void)
+{
+#ifdef	PTHREADS
+	SCRATCH SCAN *s;
+	SCRATCH char *p;
+	char name[MAXLINE + 1];
+
+	if (prescans.nscans) {
+		for (s = prescans.scans; s < prescans.scans + prescans.nscans; ++s)
+			if (s -> file.text) add_fetch(&prefetches,s -> file.name,FCLAIMED);
+		for (s = prescans.scans; s < prescans.scans + prescans.nscans; ++s)
+			if (!s -> file.text) add_fetch(&prefetches,s -> file.name,FQUEUED);
+			else if (!s -> ok)
+				for (p = s -> file.text; (p = next_inc(p,s -> file.text + s -> file.len,name)); )
+					add_fetch(&prefetches,name,FQUEUED);
+	}
+	else for (p = filestk -> text; (p = next_inc(p,filestk -> end,name)); )
+		add_fetch(&prefetches,name,FQUEUED);
+	if (!prefetches.nfetches) return;
+
+	prefetches.next = 0;  prefetches.stop = FALSE;
+	pthread_mutex_init(&prefetches.lock,NULL);
+	pthread_cond_init(&prefetches.ready,NULL);
+	if (!(prefetches.started = !pthread_create(&prefetches.thread,NULL,fetch_files,&prefetches))) {
+		pthread_cond_destroy(&prefetches.ready);
+		pthread_mutex_destroy(&prefetches.lock);
+	}
+#endif
+}
+
+#ifdef	PTHREADS
+
+/*  Add a file to the list in the given state, unless it's there	*/
+/*  already.  The I/O thread holds the lock when it calls this.  If	*/
+/*  there's not enough memory, the file just isn't read ahead.		*/
+
+static void add_fetch(FETCHES *fs, char *nam, int state)
+{
+	SCRATCH FETCH *f;
+	SCRATCH unsigned n;
+
+	for (f = fs -> fetches; f < fs -> fetches + fs -> nfetches; ++f)
+		if (!strcmp(f -> file.name,nam)) return;
+	if (fs -> nfetches == fs -> maxfetches) {
+		n = fs -> maxfetches ? 2 * fs -> maxfetches : 16;
+		if (!(f = realloc(fs -> fetches,n * sizeof(FETCH)))) return;
+		fs -> fetches = f;  fs -> maxfetches = n;
+	}
+	f = fs -> fetches + fs -> nfetches;
+	if (!(f -> file.name = malloc(strlen(nam) + 1))) return;
+	strcpy(f -> file.name,nam);
+	f -> file.text = NULL;  f -> file.len = 0;  f -> file.warm = FALSE;
+	f -> state = state;
+	++fs -> nfetches;
+}
+
+/*  Include prefetch I/O thread.  Files are read in the order they were	*/
+/*  found until there are none left or pass 1 is done with them.  The	*/
+/*  list is only looked at or changed with the lock held, and a file	*/
+/*  is read with it released.						*/
+
+static void *fetch_files(void *arg)
+{
+	SCRATCH FETCHES *fs;
+	SCRATCH unsigned i;
+	SCRATCH char *p;
+	SCRATCH int ok;
+	SOURCE f;
+	char name[MAXLINE + 1];
+
+	fs = arg;
+	pthread_mutex_lock(&fs -> lock);
+	for (;;) {
+		while (fs -> next < fs -> nfetches && fs -> fetches[fs -> next].state != FQUEUED) ++fs -> next;
+		if (fs -> stop || fs -> next == fs -> nfetches) break;
+		i = fs -> next++;
+		fs -> fetches[i].state = FREADING;  f = fs -> fetches[i].file;
+		pthread_mutex_unlock(&fs -> lock);
+
+		ok = fetch_one(&f);
+
+		pthread_mutex_lock(&fs -> lock);
+		fs -> fetches[i].file = f;
+		fs -> fetches[i].state = ok ? FREAD : FFAILED;
+		pthread_cond_broadcast(&fs -> ready);
+		if (ok) for (p = f.text; (p = next_inc(p,f.text + f.len,name)); )
+			add_fetch(fs,name,FQUEUED);
+	}
+	pthread_mutex_unlock(&fs -> lock);
+	return arg;
+}
+
+/*  Read a file for the I/O thread.  Returns FALSE if the file doesn't	*/
+/*  open, or if a fatal error occurs while it's read, in which case	*/
+/*  pass 1 reads it again and reports the error.			*/
+
+static int fetch_one(SOURCE *f)
+{
+	jmp_buf env;
+
+	bail = &env;
+	if (setjmp(env) || !fetch_source(f)) {
+		if (!f -> warm) free(f -> text);
+		f -> text = NULL;  f -> len = 0;
+		bail = NULL;
+		return FALSE;
+	}
+	bail = NULL;
+	return TRUE;
+}
+
+#endif
+
+/*  Hand the text of an INCLUDE file to the source cache, if the	*/
+/*  pre-scan or the I/O thread has read it.  If the thread is reading	*/
+/*  it now, it is waited for.  If the thread hasn't come to it yet, it	*/
+/*  is left for pass 1 to read, and the thread passes it by.		*/
+
+static void fetched(char *nam)
+{
+#ifdef	PTHREADS
+	SCRATCH SCAN *s;
+	SCRATCH unsigned i;
+
+	for (s = prescans.scans; s < prescans.scans + prescans.nscans; ++s)
+		if (!strcmp(s -> file.name,nam)) {
+			if (!s -> taken && give_source(&s -> file)) s -> taken = TRUE;
+			return;
+		}
+
+	if (!prefetches.started) return;
+	pthread_mutex_lock(&prefetches.lock);
+	for (i = 0; i < prefetches.nfetches && strcmp(prefetches.fetches[i].file.name,nam); ++i);
+	if (i < prefetches.nfetches) {
+		while (prefetches.fetches[i].state == FREADING)
+			pthread_cond_wait(&prefetches.ready,&prefetches.lock);
+		switch (prefetches.fetches[i].state) {
+			case FQUEUED:	prefetches.fetches[i].state = FCLAIMED;  break;
+
+			case FREAD:	if (give_source(&prefetches.fetches[i].file))
+						prefetches.fetches[i].state = FTAKEN;
+					break;
+		}
+	}
+	pthread_mutex_unlock(&prefetches.lock);
+#endif
+}
+
+/*  Include prefetch teardown routine.  The I/O thread is stopped once	*/
+/*  it's done with the file it's reading, and the text of every file	*/
+/*  that wasn't handed to the source cache goes back to the heap.	*/
+
+static void stop_fetch(void)
+{
+	SCRATCH FETCH *f;
+
+#ifdef	PTHREADS
+	if (prefetches.started) {
+		pthread_mutex_lock(&prefetches.lock);
+		prefetches.stop = TRUE;
+		pthread_mutex_unlock(&prefetches.lock);
+		pthread_join(prefetches.thread,NULL);
+		pthread_cond_destroy(&prefetches.ready);
+		pthread_mutex_destroy(&prefetches.lock);
+		prefetches.started = FALSE;
+	}
+#endif
+	for (f = prefetches.fetches; f < prefetches.fetches + prefetches.nfetches; ++f) {
+		free(f -> file.name);
+		if (f -> state == FREAD && !f -> file.warm) free(f -> file.text);
+	}
+	free(prefetches.fetches);
+	prefetches.fetches = NULL;  prefetches.nfetches = prefetches.maxfetches = 0;
+}
+
+/*  Add the error on the line being listed to the job's diagnostics.	*/
+/*  If there's not enough memory, a fatal error occurs.			*/
+
+static void diagnose(void)
+{
+	SCRATCH DIAG *d;
+	SCRATCH char *f;
+	SCRATCH unsigned n;
+
+	curjob -> diags = grow(curjob -> diags,&maxdiags,curjob -> ndiags + 1,
+		sizeof(DIAG));
+	d = curjob -> diags + curjob -> ndiags++;
+	d -> code = errcode;  d -> address = address;
+	d -> file = d -> text = NULL;
+
+	f = locate(lline,&d -> line);
+	if (f) d -> file = copy(f,strlen(f));
+	for (n = llen; n && (lline[n - 1] == '\n' || lline[n - 1] == '\r'); --n);
+	d -> text = copy(lline,n);
+}
+
+/*  Copy n characters of a string into a block drawn from the heap.	*/
+/*  If there's not enough memory, a fatal error occurs.			*/
+
+static char *copy(char *s, unsigned n)
+{
+	SCRATCH char *p;
+
+	if (!(p = malloc(n + 1))) fatal_error(NOMEM);
+	memcpy(p,s,n);  p[n] = '\0';
+	return p;
+}
+
+/*  Include fragment routines.  In pass 1, each file INCLUDEd by the	*/
+/*  main source is either replaced by its fragment from the build	*/
+/*  cache or recorded as a new fragment.  In pass 2, a fragment from	*/
+/*  the cache puts out its stored lines, and a new fragment saves the	*/
+/*  lines that it puts out.  Once the assembly is done, the new		*/
+/*  fragments are written to the cache.					*/
+
+/*  Note a symbol touched by the fragment being recorded.  The state of	*/
+/*  the symbol before the pass is kept the first time that it's touched	*/
+/*  in the pass.  Pass 1 skips the operands of most instructions, so a	*/
+/*  symbol may be touched for the first time in pass 2.			*/
+
+void touch(SYMBOL *s, char *nam)
+{
+	SCRATCH DEP *d;
+	SCRATCH unsigned k;
+
+	if (s && s -> mark == serial) return;
+	deps = grow(deps,&maxdeps,ndeps + 1,sizeof(DEP));
+	d = deps + ndeps++;
+	d -> name = save_text(nam);
+	for (k = PRE1; k <= POST2; ++k) d -> attr[k] = d -> valu[k] = 0;
+	d -> late = pass == 2;
+	k = d -> late ? PRE2 : PRE1;
+	d -> attr[k] = s ? s -> attr : 0;
+	d -> valu[k] = s ? s -> valu : 0;
+	if (s) s -> mark = serial;
+}
+
+/*  Note a file read by the fragment being recorded.			*/
+
+static void note_file(char *nam)
+{
+	fnames = grow(fnames,&maxfnames,nfnames + 1,sizeof(unsigned));
+	fnames[nfnames++] = save_text(nam);
+}
+
+/*  Start recording a fragment for the INCLUDE file just opened.	*/
+
+static void new_frag(char *nam)
+{
+	SCRATCH FRAG *f;
+
+	frags = grow(frags,&maxfrags,nfrags + 1,sizeof(FRAG));
+	f = frags + nfrags++;
+	f -> rec = f -> end = nrecs - 1;  f -> name = save_text(nam);
+	f -> pc = f -> epc = pc;  f -> depth = filesp;  f -> ifsp = ifsp;
+	f -> dep = ndeps;  f -> ndeps = 0;
+	f -> file = nfnames;  f -> nfiles = 0;
+	f -> line = f -> nlines = 0;  f -> block = NULL;
+	f -> state = FRAGREC;
+	note_file(nam);
+	serial = nfrags;  watch = TRUE;
+}
+
+/*  Keep each of the fragment's symbols once.  A symbol touched in pass	*/
+/*  1 is kept over the same symbol touched in pass 2.			*/
+
+static int by_name(const void *a, const void *b)
+{
+	SCRATCH int c;
+
+	c = strcmp(text + ((DEP *) a) -> name,text + ((DEP *) b) -> name);
+	return c ? c : ((DEP *) a) -> late - ((DEP *) b) -> late;
+}
+
+static void unique(FRAG *f)
+{
+	SCRATCH DEP *d;
+	SCRATCH unsigned i, n;
+
+	d = deps + f -> dep;
+	qsort(d,ndeps - f -> dep,sizeof(DEP),by_name);
+	for (n = i = 0; i < ndeps - f -> dep; ++i)
+		if (!n || strcmp(text + d[i].name,text + d[n - 1].name)) d[n++] = d[i];
+	ndeps = f -> dep + (f -> ndeps = n);
+}
+
+/*  Stop recording the fragment once pass 1 has left its INCLUDE file.	*/
+/*  Each symbol and file is kept once, and the state of the symbols	*/
+/*  after pass 1 is taken.  A fragment that leaves the IF stack other	*/
+/*  than as it found it can't be kept.					*/
+
+static void end_frag(void)
+{
+	SCRATCH FRAG *f;
+	SCRATCH unsigned i, j, n;
+
+	f = frags + nfrags - 1;
+	watch = FALSE;
+	f -> end = nrecs;  f -> epc = pc;
+	if (ifsp != (int) f -> ifsp) f -> state = FRAGBAD;
+
+	unique(f);
+
+	for (n = i = 0; i < nfnames - f -> file; ++i) {
+		for (j = 0; j < n && strcmp(text + fnames[f -> file + i],
+			text + fnames[f -> file + j]); ++j);
+		if (j == n) fnames[f -> file + n++] = fnames[f -> file + i];
+	}
+	nfnames = f -> file + (f -> nfiles = n);
+
+	snapshot(f,POST1);
+}
+
+/*  Take the state of the fragment's symbols, see if the symbols are	*/
+/*  still in a state that was taken, or put them back into it.		*/
+
+static void snapshot(FRAG *f, unsigned k)
+{
+	SCRATCH DEP *d;
+	SCRATCH SYMBOL *s;
+	SYMBOL *find_symbol(char *);
+
+	for (d = deps + f -> dep; d < deps + f -> dep + f -> ndeps; ++d) {
+		s = find_symbol(text + d -> name);
+		d -> attr[k] = s ? s -> attr : 0;
+		d -> valu[k] = s ? s -> valu : 0;
+	}
+}
+
+static int same(FRAG *f, unsigned k)
+{
+	SCRATCH DEP *d;
+	SCRATCH SYMBOL *s;
+	SYMBOL *find_symbol(char *);
+
+	for (d = deps + f -> dep; d < deps + f -> dep + f -> ndeps; ++d) {
+		if (d -> late && k < PRE2) continue;
+		s = find_symbol(text + d -> name);
+		if ((s ? s -> attr : 0) != d -> attr[k] ||
+			(s ? s -> valu : 0) != d -> valu[k]) return FALSE;
+	}
+	return TRUE;
+}
+
+static void apply(FRAG *f, unsigned k)
+{
+	SCRATCH DEP *d;
+	SCRATCH SYMBOL *s;
+	SYMBOL *find_symbol(char *), *new_symbol(char *);
+
+	for (d = deps + f -> dep; d < deps + f -> dep + f -> ndeps; ++d) {
+		if (d -> late && k < PRE2) continue;
+		s = d -> attr[k] ? new_symbol(text + d -> name) :
+			find_symbol(text + d -> name);
+		if (s) { s -> attr = d -> attr[k];  s -> valu = d -> valu[k]; }
+	}
+}
+
+/*  Read a line of a fragment file and take off its newline.  Returns	*/
+/*  FALSE at the end of the file or if the line is too long.		*/
+
+static int frag_line(FILE *fp, char *buf)
+{
+	SCRATCH char *p;
+
+	if (!fgets(buf,FRAGLINE,fp)) return FALSE;
+	if (!(p = strchr(buf,'\n'))) return FALSE;
+	*p = '\0';
+	return TRUE;
+}
+
+/*  Convert n hexadecimal numbers separated by spaces at the start of a	*/
+/*  fragment file line.  Returns a pointer to the rest of the line, or	*/
+/*  NULL if the numbers aren't there.					*/
+
+static char *frag_nums(char *p, unsigned *u, unsigned n)
+{
+	SCRATCH char *e;
+
+	while (n--) {
+		*u++ = strtoul(p,&e,16);
+		if (e == p || (*e && *e != ' ')) return NULL;
+		p = *e ? e + 1 : e;
+	}
+	return p;
+}
+
+/*  Convert a pair of hexadecimal digits.  Returns -1 if they aren't	*/
+/*  there.								*/
+
+static int hex2(char *p)
+{
+	SCRATCH char *h, *l;
+	static char digits[] = "0123456789abcdef";
+
+	if (!p[0] || !p[1] || !(h = strchr(digits,p[0])) || !(l = strchr(digits,p[1])))
+		return -1;
+	return (int) (h - digits) << 4 | (int) (l - digits);
+}
+
+/*  Look for a fragment in the build cache for the INCLUDE file just	*/
+/*  opened.  If there is one, it was recorded at this $ and IF stack	*/
+/*  depth, the files it read are as they were, and the symbols it	*/
+/*  touched are as they were, its symbols are put into their state	*/
+/*  after pass 1, its lines go into the line store for pass 2, and TRUE	*/
+/*  is returned.  Otherwise, nothing is changed and FALSE is returned.	*/
+
+static int use_frag(char *nam)
+{
+	SCRATCH FILE *fp;
+	SCRATCH FRAG *f;
+	SCRATCH DEP *d;
+	SCRATCH LINE *l;
+	SCRATCH char *block, *p, *q;
+	SCRATCH unsigned i, j, dep, line, pool, tpos;
+	SCRATCH int ok;
+	INPUT in;
+	FRAG g;
+	char key[20], hash[20], path[MAXLINE + 64], buf[FRAGLINE];
+	unsigned u[8], w[9];
+	int m;
+
+	text_hash(key,nam,filestk[filesp].text,
+		filestk[filesp].end - filestk[filesp].text);
+	if (!(fp = fopen(cache_name(curjob,key,"frg",path),"rb"))) return FALSE;
+	dep = ndeps;  line = nlines;  pool = ncode;  tpos = ntext;  block = NULL;
+
+	ok = frag_line(fp,buf) && !strcmp(buf,FRAGTAG) && frag_line(fp,buf) &&
+		(p = frag_nums(buf,u,8)) && !*p && u[0] == pc && u[1] == (unsigned) filesp && u[2] == (unsigned) ifsp;
+	if (ok && !(block = malloc(u[7] + 1))) fatal_error(LINES);
+
+	for (i = 0; ok && i < u[4]; ++i) {
+		ok = frag_line(fp,buf) && strlen(buf) > 17 && buf[16] == ' ';
+		if (!ok) break;
+		if (buf[0] == '-') ok = !open_source(&in,buf + 17);
+		else if ((ok = open_source(&in,buf + 17))) {
+			text_hash(hash,NULL,in.text,in.end - in.text);
+			ok = !strncmp(buf,hash,16);
+		}
+	}
+
+	for (i = 0; ok && i < u[5]; ++i) {
+		deps = grow(deps,&maxdeps,ndeps + 1,sizeof(DEP));
+		d = deps + ndeps++;
+		ok = frag_line(fp,buf) && (p = frag_nums(buf,w,9)) && *p;
+		if (!ok) break;
+		d -> late = w[0] != 0;
+		for (j = PRE1; j <= POST2; ++j) {
+			d -> attr[j] = w[2 * j + 1];  d -> valu[j] = w[2 * j + 2];
+		}
+		d -> name = save_text(p);
+	}
+	g.dep = dep;  g.ndeps = ndeps - dep;
+	ok = ok && same(&g,PRE1);
+
+	for (p = block, i = 0; ok && i < u[6]; ++i) {
+		lines = grow(lines,&maxlines,nlines + 1,sizeof(LINE));
+		l = lines + nlines++;
+		ok = frag_line(fp,buf) && (q = frag_nums(buf,w,6)) && !*q &&
+			!(w[3] & NEWPAGE) && (l -> bytes = w[4]) <= MAXLINE &&
+			(l -> tlen = w[5]) <= u[7] - (unsigned) (p - block) &&
+			fread(p,1,l -> tlen,fp) == l -> tlen &&
+			frag_line(fp,buf) && strlen(buf) == 2 * l -> bytes;
+		if (!ok) break;
+		l -> address = w[0];  l -> seek = w[1];
+		l -> errcode = w[2];  l -> flags = w[3];  l -> pagelen = l -> title = 0;
+		l -> text = p;  p += l -> tlen;
+		code = grow(code,&maxcode,ncode + l -> bytes,1);
+		l -> code = ncode;
+		for (j = 0; ok && j < l -> bytes; ++j) {
+			m = hex2(buf + 2 * j);
+			ok = m >= 0;
+			code[ncode++] = m;
+		}
+	}
+	fclose(fp);
+
+	if (!ok) {
+		free(block);
+		ndeps = dep;  nlines = line;  ncode = pool;  ntext = tpos;
+		return FALSE;
+	}
+
+	frags = grow(frags,&maxfrags,nfrags + 1,sizeof(FRAG));
+	f = frags + nfrags++;
+	f -> rec = f -> end = nrecs - 1;  f -> name = save_text(nam);
+	f -> pc = pc;  f -> epc = u[3];  f -> depth = filesp;  f -> ifsp = ifsp;
+	f -> dep = dep;  f -> ndeps = u[5];
+	f -> file = nfnames;  f -> nfiles = 0;
+	f -> line = line;  f -> nlines = u[6];  f -> block = block;
+	f -> state = FRAGUSED;
+
+	apply(f,POST1);
+	pc = f -> epc;
+	return TRUE;
+}
+
+/*  Pass 2 has put out the INCLUDE line of the next fragment.  A	*/
+/*  fragment from the cache puts out its lines if $ and its symbols are	*/
+/*  as they were when it was recorded.  If not, the assembly has to be	*/
+/*  done again without the cache.  A new fragment starts saving lines.	*/
+
+static void next_frag(void)
+{
+	SCRATCH FRAG *f;
+	SCRATCH LINE *l;
+
+	f = frags + fragpos;
+	if (f -> state == FRAGREC) {
+		snapshot(f,PRE2);
+		f -> line = nlines;
+		serial = nfrags + fragpos + 1;  latedep = ndeps;
+		capturing = watch = TRUE;
+		return;
+	}
+
+	++fragpos;
+	if (f -> state != FRAGUSED) return;
+
+	if (pc != f -> pc || !same(f,PRE2)) { restart = done = TRUE;  return; }
+	for (l = lines + f -> line; l < lines + f -> line + f -> nlines; ++l) {
+		if (l -> errcode != ' ') ++errors;
+		put_line(l,FALSE);
+	}
+	apply(f,POST2);
+	pc = f -> epc;
+}
+
+/*  Pass 2 has left the INCLUDE file of the fragment saving lines.  The	*/
+/*  symbols it touched in pass 1 are moved to the end of the symbol	*/
+/*  state store to join the ones it touched in pass 2.  If $ came out	*/
+/*  as in pass 1 and the file changed neither the page length nor the	*/
+/*  title, the fragment is ready to keep.				*/
+
+static void end_capture(void)
+{
+	SCRATCH FRAG *f;
+	SCRATCH LINE *l;
+
+	f = frags + fragpos++;
+	capturing = watch = FALSE;
+	deps = grow(deps,&maxdeps,ndeps + f -> ndeps,sizeof(DEP));
+	memcpy(deps + ndeps,deps + f -> dep,f -> ndeps * sizeof(DEP));
+	ndeps += f -> ndeps;
+	f -> dep = latedep;
+	unique(f);
+
+	f -> nlines = nlines - f -> line;
+	f -> state = pc == f -> epc ? FRAGDONE : FRAGBAD;
+	for (l = lines + f -> line; l < lines + nlines; ++l)
+		if (l -> flags & NEWPAGE) f -> state = FRAGBAD;
+	snapshot(f,POST2);
+}
+
+/*  Write the new fragments to the build cache.  Each is written to a	*/
+/*  file of its own and renamed into place.  A fragment that can't be	*/
+/*  written is simply not kept.						*/
+
+static void keep_frags(void)
+{
+	SCRATCH FRAG *f;
+	SCRATCH FILE *fp;
+	SCRATCH DEP *d;
+	SCRATCH LINE *l;
+	SCRATCH SOURCE *s;
+	SCRATCH unsigned i, tsize;
+	SCRATCH int ok;
+	char key[20], hash[20], nam[MAXLINE + 64], tmp[MAXLINE + 96];
+
+	for (f = frags; f < frags + nfrags; ++f) {
+		if (f -> state != FRAGDONE) continue;
+		for (tsize = 0, l = lines + f -> line; l < lines + f -> line + f -> nlines; ++l)
+			tsize += l -> tlen;
+
+		s = source_of(text + f -> name);
+		text_hash(key,text + f -> name,s -> text,s -> len);
+		sprintf(tmp,"%s.%lx",cache_name(curjob,key,"frg",nam),
+			(unsigned long) (size_t) tmp);
+		if (!(fp = fopen(tmp,"wb"))) continue;
+
+		fprintf(fp,"%s\n%x %x %x %x %x %x %x %x\n",FRAGTAG,f -> pc,f -> depth,
+			f -> ifsp,f -> epc,f -> nfiles,f -> ndeps,f -> nlines,tsize);
+		for (i = f -> file; i < f -> file + f -> nfiles; ++i) {
+			s = source_of(text + fnames[i]);
+			if (s && s -> text) text_hash(hash,NULL,s -> text,s -> len);
+			else strcpy(hash,"----------------");
+			fprintf(fp,"%s %s\n",hash,text + fnames[i]);
+		}
+		for (d = deps + f -> dep; d < deps + f -> dep + f -> ndeps; ++d)
+			fprintf(fp,"%x %x %x %x %x %x %x %x %x %s\n",d -> late,d -> attr[0],d -> valu[0],
+				d -> attr[1],d -> valu[1],d -> attr[2],d -> valu[2],
+				d -> attr[3],d -> valu[3],text + d -> name);
+		for (l = lines + f -> line; l < lines + f -> line + f -> nlines; ++l) {
+			fprintf(fp,"%x %x %x %x %x %x\n",l -> address,l -> seek,
+				l -> errcode & 0xff,l -> flags & 0xff,l -> bytes,l -> tlen);
+			fwrite(l -> text,1,l -> tlen,fp);
+			for (i = 0; i < l -> bytes; ++i) fprintf(fp,"%02x",code[l -> code + i]);
+			fputc('\n',fp);
+		}
+
+		ok = !ferror(fp);
+		if (fclose(fp) == EOF || !ok ||
+			(rename(tmp,nam) && (remove(nam) || rename(tmp,nam)))) remove(tmp);
+	}
+}
+
+/*  Find a file in the source cache, or NULL if it isn't there.		*/
+
+static SOURCE *source_of(char *nam)
+{
+	SCRATCH SOURCE *s, *e;
+	unsigned n;
+
+	s = source_list(&n);
+	for (e = s + n; s < e; ++s) if (!strcmp(s -> name,nam)) return s;
+	return NULL;
+}
+
+/*  Fragment store teardown routine.  Everything goes back to the heap.	*/
+
+static void clear_frags(void)
+{
+	SCRATCH FRAG *f;
+
+	for (f = frags; f < frags + nfrags; ++f) free(f -> block);
+	free(frags);  free(deps);  free(fnames);
+	frags = NULL;  deps = NULL;  fnames = NULL;
+	nfrags = ndeps = nfnames = 0;
+	maxfrags = maxdeps = maxfnames = 0;
+	watch = capturing = FALSE;
+}
+
+/*  Symbol image routines.  A symbol image written by -p holds the	*/
+/*  symbols that a header file defines, so that a source that INCLUDEs	*/
+/*  the image or loads it with -s gets them without the header being	*/
+/*  assembled.  The image is read through the source cache.  It is	*/
+/*  text rather than a binary image to be mapped, since reading its	*/
+/*  lines takes about a quarter of the time of a load.  The rest goes	*/
+/*  to entering the symbols and to hashing the header to see that it	*/
+/*  hasn't changed, which a binary image would need just the same.	*/
+
+static int is_syms(INPUT *in)
+{
+	SCRATCH unsigned n;
+
+	n = strlen(SYMTAG);
+	return (unsigned) (in -> end - in -> text) > n &&
+		!memcmp(in -> text,SYMTAG,n) && in -> text[n] == '\n';
+}
+
+/*  Copy the rest of the line at p, up to the last character of the	*/
+/*  image at end, to nam.  Returns the start of the next line, or NULL	*/
+/*  if the line is too long.						*/
+
+static char *line_of(char *p, char *end, char *nam)
+{
+	SCRATCH char *q;
+
+	if (p > end || !(q = memchr(p,'\n',end + 1 - p)) || q - p > MAXLINE)
+		return NULL;
+	memcpy(nam,p,q - p);  nam[q - p] = '\0';
+	return q + 1;
+}
+
+/*  Load the symbols of an image, as the EQU and SET lines of its	*/
+/*  header would define them in this pass.  The name of the header is	*/
+/*  returned in head.  Nothing is loaded unless every file the image	*/
+/*  came from is as it was and the whole image is sound.		*/
+
+static int load_syms(INPUT *in, char *head)
+{
+	SCRATCH char *p, *q, *r;
+	SCRATCH unsigned i, nf, ns, v;
+	SCRATCH int old;
+	SCRATCH SYMBOL *s;
+	SYMBOL *new_symbol(char *);
+	INPUT f;
+	char hash[20], nam[MAXLINE + 1];
+
+	p = in -> text + strlen(SYMTAG) + 1;
+	nf = strtoul(p,&q,16);
+	if (q == p || *q != ' ') return IMGBAD;
+	ns = strtoul(p = q + 1,&q,16);
+	if (q == p || *q++ != '\n' || !nf) return IMGBAD;
+
+	for (old = FALSE, i = 0; i < nf; ++i, q = p) {
+		if (in -> end - q < 18 || q[16] != ' ' ||
+			!(p = line_of(q + 17,in -> end,nam))) return IMGBAD;
+		if (!i) strcpy(head,nam);
+		if (watch) note_file(nam);
+
+		if (*q == '-') old |= open_source(&f,nam);
+		else if (!open_source(&f,nam)) old = TRUE;
+		else {
+			text_hash(hash,NULL,f.text,f.end - f.text);
+			old |= memcmp(q,hash,16) != 0;
+		}
+	}
+	if (old) return IMGOLD;
+
+	for (r = q, i = 0; i < ns; ++i, q = p)
+		if (in -> end - q < 7 || (*q != 'E' && *q != 'S') || hex2(q + 1) < 0 ||
+			hex2(q + 3) < 0 || q[5] != ' ' ||
+			!(p = line_of(q + 6,in -> end,nam)) || !nam[0]) return IMGBAD;
+
+	reserve_symbols(ns);
+	for (q = r, i = 0; i < ns; ++i, q = p) {
+		p = line_of(q + 6,in -> end,nam);
+		v = hex2(q + 1) << 8 | hex2(q + 3);
+		s = new_symbol(nam);
+
+		if (pass == 1) {
+			if (!s -> attr || (*q == 'S' && (s -> attr & SOFT))) {
+				s -> attr = FORWD + VAL + (*q == 'S' ? SOFT : 0);
+				s -> valu = v;
+			}
+		}
+
+		else if (*q == 'S') {
+			if (!s -> attr || (s -> attr & SOFT)) {
+				s -> attr = SOFT + VAL;  s -> valu = v;
+			}
+			else error('M');
+		}
+
+		else {
+			if (s -> attr && s -> valu != v) error('M');
+			else s -> valu = v;
+			s -> attr = VAL;
+		}
+	}
+	return IMGOK;
+}
+
+/*  INCLUDE a symbol image.  If the header it came from has changed	*/
+/*  since, the header is INCLUDEd instead.				*/
+
+static void inc_syms(char *nam)
+{
+	INPUT in;
+	char head[MAXLINE + 1];
+
+	open_source(&in,nam);
+	if (watch) note_file(nam);
+
+	switch (load_syms(&in,head)) {
+		case IMGOK:	if (pass == 1) { rec -> flags |= SYMIMG;  ordered = TRUE; }
+				return;
+
+		case IMGOLD:	if (open_source(filestk + ++filesp,head)) return;
+				--filesp;
+	}
+	error('V');
+	if (pass == 1) rec -> flags |= INCFAIL;
+}
+
+/*  Load a symbol image named with -s.  If it can't be loaded, a fatal	*/
+/*  error occurs.							*/
+
+static void preload(char *nam)
+{
+	INPUT in;
+	char head[MAXLINE + 1];
+
+	if (!open_source(&in,nam)) fatal_error(SYMOPEN);
+	if (!is_syms(&in)) fatal_error(SYMBAD);
+
+	switch (load_syms(&in,head)) {
+		case IMGOLD:	fatal_error(SYMOLD);  break;
+		case IMGBAD:	fatal_error(SYMBAD);  break;
+	}
+}
@@ -181,6 +181,10 @@ Aztec CII compiler, so I didn't bother to support it at all.
 */
 
 #include <stdio.h>
+#include <setjmp.h>
+#ifdef	PTHREADS
+#include <pthread.h>
+#endif
 
 /*  Comment out all but the line containing the name of your compiler:	*/
 // #define	AZTEC_C
@@ -220,7 +224,24 @@ functions "SCRATCH int", "SCRATCH unsigned", etc.  A SCRATCH
 varible is made static below, but you might want to try register	
 instead.								*/
 
+#ifdef	PTHREADS
+#define	SCRATCH
+#else
 #define	SCRATCH		static
+#endif
+
+/*  The assembler keeps its state in global mailboxes.  To let several	*/
+/*  assemblies run at once in batch mode (-j), each thread needs its	*/
+/*  own copy of that state, so every mailbox is declared TLOCAL.  If	*/
+/*  PTHREADS is defined, TLOCAL is made thread-local and the SCRATCH	*/
+/*  variables above become auto.  Otherwise, batch mode assembles the	*/
+/*  files one after another.						*/
+
+#ifdef	PTHREADS
+#define	TLOCAL		__thread
+#else
+#define	TLOCAL
+#endif
 
 /*  A slow, but portable way of cracking an unsigned into its various	*/
 /*  component parts:							*/
@@ -238,26 +259,119 @@ instead.								*/
 
 #define	FILES		4
 
+/*  The file name that stands for the standard input or output:		*/
+
+#define	STDNAME		"-"
+
+/*  Messages are printed on stdout unless an output file is written	*/
+/*  there, in which case they go to stderr (A85.C):			*/
+
+#define	CONSOLE		(tostderr ? stderr : stdout)
+
+/*  The most assemblies that batch mode will run at once:		*/
+
+#define	MAXJOBS		64
+
+/*  The seconds that the assembler server waits on a client that stops	*/
+/*  sending its request or reading the answer:				*/
+
+#define	SERVWAIT	10
+
+/*  Source file input (A85EVAL.C).  Each source file is read into	*/
+/*  memory the first time it is opened and kept there for the rest of	*/
+/*  the run, so a file that is included twice is read once.  Every	*/
+/*  open file on the include stack has a read pointer into its copy.	*/
+/*  A newline always follows the last character of a file's copy.	*/
+
+typedef struct {
+    char *name;		/*  file name as given				*/
+    char *text;		/*  file contents				*/
+    unsigned len;	/*  length of file contents			*/
+    char warm;		/*  contents belong to the warm file cache	*/
+} SOURCE;
+
+/*  An entry in the server's warm file cache (A85EVAL.C).  The file is	*/
+/*  read again when its size, its modification or status change time,	*/
+/*  or the file it names has changed.					*/
+
+typedef struct {
+    char *path;		/*  full path name				*/
+    char *text;		/*  file contents, newline after		*/
+    unsigned len;	/*  length of file contents			*/
+    long size, mtime;	/*  file size and modification time when read	*/
+    long mnsec, ctime;	/*  nanoseconds of mtime, status change time	*/
+    unsigned long dev, ino;	/*  device and i-node of the file	*/
+} WARM;
+
+typedef struct {
+    char *text;		/*  file contents				*/
+    char *pos;		/*  next character to read			*/
+    char *end;		/*  end of file contents			*/
+    int eof;		/*  set once a read goes past the end		*/
+} INPUT;
+
 /*  The fatal error messages generated by the assembler:		*/
 
 #define	ASMOPEN		"Source File Did Not Open"
 #define	ASMREAD		"Error Reading Source File"
+#define	BINOPEN		"Binary File Did Not Open"
 #define	DSKFULL		"Disk or Directory Full"
 #define	FLOFLOW		"File Stack Overflow"
 #define	HEXOPEN		"Object File Did Not Open"
+#define	SRECOPEN	"S-Record File Did Not Open"
 #define	IFOFLOW		"If Stack Overflow"
 #define	LSTOPEN		"Listing File Did Not Open"
 #define	NOASM		"No Source File Specified"
+#define	NOMEM		"Not Enough Memory"
 #define	SYMBOLS		"Too Many Symbols"
+#define	SYMBAD		"Bad Symbol File"
+#define	SYMOLD		"Symbol File Out of Date"
+#define	SYMOPEN		"Symbol File Did Not Open"
+#define	LINES		"Too Many Source Lines"
+#define	SOCKOPEN	"Server Socket Did Not Open"
+#define	NOSERVER	"Server Did Not Answer"
+#define	BADREQ		"Bad Server Request"
 
 /*  The warning messages generated by the assembler:			*/
 
 #define	BADOPT		"Illegal Option Ignored"
+#define	BADFILL		"-f Option Ignored -- Bad Fill Byte"
+#define	BADJOBS		"-j Option Ignored -- Bad Job Count"
+#define	BADRANGE	"-r Option Ignored -- Bad Address Range"
+#define	BADREC		"-w Option Ignored -- Bad Record Length"
+#define	BADTHREADS	"-t Option Ignored -- Bad Thread Count"
+#define	NOCACHE		"Build Cache Not Written"
+#define	NODIR		"-c Option Ignored -- No Directory Name"
+#define	NOBIN		"-b Option Ignored -- No File Name"
 #define	NOHEX		"-o Option Ignored -- No File Name"
+#define	NOSREC		"-x Option Ignored -- No File Name"
 #define	NOLST		"-l Option Ignored -- No File Name"
+#define	NOIMG		"-p Option Ignored -- No File Name"
+#define	NOPRE		"-s Option Ignored -- No File Name"
+#define	NODEP		"-m Option Ignored -- No File Name"
+#define	DEPNOT		"Dependency File Not Written"
+#define	NOSERVE		"-d Option Ignored -- No Socket Name"
+#define	NOCLIENT	"-u Option Ignored -- No Socket Name"
+#define	SYMNOT		"Symbol File Not Written"
+#define	SYMPC		"Symbol File Not Written -- Source Uses or Moves $"
 #define	TWOASM		"Extra Source File Ignored"
+#define	TWOBIN		"Extra Binary File Ignored"
 #define	TWOHEX		"Extra Object File Ignored"
 #define	TWOLST		"Extra Listing File Ignored"
+#define	TWOSREC		"Extra S-Record File Ignored"
+#define	TWOSTD		"Extra Output to Standard Output Ignored"
+
+/*  The reasons reported with -v for doing pass 2 in order although	*/
+/*  -t asked for threads (A85.C):					*/
+
+#define	ORDSHORT	"Too Few Lines to Split"
+#define	ORDSET		"Source Uses SET or a Symbol Image"
+#define	ORDCACHE	"Build Cache in Use"
+#define	ORDONE		"Single-Pass Mode"
+#define	ORDTHREAD	"Thread Did Not Start"
+#define	ORDFAIL		"Part Can't Be Assembled on Its Own"
+#define	ORDSTEP		"Parts Out of Step"
+#define	ORDNONE		"No Thread Support"
 
 /*  Line assembler (A85.C) constants:					*/
 
@@ -318,12 +432,137 @@ instead.								*/
 #define	IFDEF	15
 #define	IFNDEF	16
 
+/*  Line assembler (A85.C) single-pass line store.  In single-pass	*/
+/*  mode, the result of each source line is kept in memory along with	*/
+/*  a list of operands that referred to symbols not yet defined.  Once	*/
+/*  the end of the source is reached, the operands are re-evaluated	*/
+/*  and patched into the stored object code, and the stored lines are	*/
+/*  sent to the listing and hex file drivers.				*/
+
+typedef struct {
+    char *text;		/*  source text for the listing			*/
+    unsigned tlen;	/*  length of source text			*/
+    unsigned code;	/*  offset of object bytes in code pool		*/
+    unsigned bytes;	/*  number of object bytes			*/
+    unsigned address;	/*  address shown in the listing		*/
+    unsigned seek;	/*  new hex file load address			*/
+    unsigned pagelen;	/*  page length after this line			*/
+    unsigned title;	/*  offset of title in text pool		*/
+    char errcode;	/*  error code for this line			*/
+    char flags;		/*  see below					*/
+} LINE;
+
+#define	LISTHEX		0x01	/*  address column shown in listing	*/
+#define	EJECT		0x02	/*  page eject after this line		*/
+#define	SEEK		0x04	/*  line moves hex file load address	*/
+#define	NEWPAGE		0x08	/*  line changes page length or title	*/
+#define	DEFINED		0x10	/*  line defines its label (see PART)	*/
+
+typedef struct {
+    unsigned kind;	/*  DATA_8, DATA_16, PORT, RST_NUM, DB, DW,	*/
+			/*  END, or EQU (listing address only)		*/
+    unsigned line;	/*  index of line in line store			*/
+    unsigned mark;	/*  index of expression's first stored token	*/
+    unsigned byte;	/*  offset of first patched object byte		*/
+    unsigned pc;	/*  value of $ when the line was assembled	*/
+    char errcode;	/*  line's error code as the operand began	*/
+} FIXUP;
+
+/*  Line assembler (A85.C) pass 1 line records.  Pass 1 keeps a record	*/
+/*  of each source line:  its text for the listing, the results of	*/
+/*  parsing its label and opcode fields, and the tokens of its operand	*/
+/*  field in the lexical analyzer's token store.  Pass 2 walks the	*/
+/*  records rather than reading and scanning the source a second time.	*/
+/*  The first of a run of lines skipped in a false IF block counts the	*/
+/*  rest, so that pass 2 can pass over them when there's no listing.	*/
+
+typedef struct {
+    char *text;		/*  source text for the listing			*/
+    unsigned tlen;	/*  length of source text			*/
+    unsigned label;	/*  offset of label in text pool		*/
+    unsigned tok;	/*  index of first token in token store		*/
+    unsigned skip;	/*  lines of a false IF block that follow	*/
+    struct _opcode *opcod;	/*  opcode, if any			*/
+    struct _symbol *lsym;	/*  symbol entered for the label	*/
+    char errcode;	/*  error code from label and opcode fields	*/
+    char flags;		/*  see below					*/
+    unsigned char depth;	/*  include file nesting depth		*/
+} RECORD;
+
+#define	BADOP		0x01	/*  opcode field is not an opcode	*/
+#define	UNSCANNED	0x02	/*  operand field was skipped		*/
+#define	INCFAIL		0x04	/*  INCLUDE file did not open		*/
+#define	ATEOF		0x08	/*  end of main source file reached	*/
+#define	REUSED		0x10	/*  INCLUDE replayed from a fragment	*/
+#define	SYMIMG		0x20	/*  INCLUDE loaded a symbol image	*/
+#define	SKIPPED		0x40	/*  skipped in a false IF block		*/
+
+/*  Line assembler (A85.C) symbol images.  A symbol image holds the	*/
+/*  symbols defined by a header file, written by -p.  It starts with	*/
+/*  SYMTAG, then the number of files it came from and of symbols in	*/
+/*  hex, then a hash and name line for each file, the header first,	*/
+/*  then a line for each symbol:  E for EQU or S for SET, its value in	*/
+/*  four hex digits, a space, and its name.				*/
+
+#define	SYMTAG		"A85 SYM 1"
+#define	IMGOK		0	/*  symbols loaded			*/
+#define	IMGOLD		1	/*  a file it came from has changed	*/
+#define	IMGBAD		2	/*  image is damaged			*/
+
+/*  Line assembler (A85.C) include fragments.  With a build cache, each	*/
+/*  file INCLUDEd by the main source is kept in the cache as a		*/
+/*  fragment:  the names and hashes of the files it reads, the value	*/
+/*  of $ where it starts, the state of every symbol it touches before	*/
+/*  and after each pass, and its lines from the line store.  When the	*/
+/*  file is INCLUDEd again from the same $ and every symbol it touches	*/
+/*  is as it was, the stored symbols and lines are used rather than	*/
+/*  assembling the file again.						*/
+
+typedef struct {
+    unsigned rec;	/*  record of the INCLUDE line			*/
+    unsigned end;	/*  first record after its lines		*/
+    unsigned name;	/*  offset of file name in text pool		*/
+    unsigned pc;	/*  value of $ at the INCLUDE line		*/
+    unsigned epc;	/*  value of $ after its lines			*/
+    unsigned depth;	/*  include file nesting depth of its lines	*/
+    unsigned ifsp;	/*  IF stack pointer at the INCLUDE line	*/
+    unsigned dep, ndeps;	/*  its symbols in the symbol state store	*/
+    unsigned file, nfiles;	/*  its files in the file name store	*/
+    unsigned line, nlines;	/*  its lines in the line store		*/
+    char *block;	/*  source text of lines read from the cache	*/
+    char state;		/*  see below					*/
+} FRAG;
+
+#define	FRAGREC		1	/*  being recorded			*/
+#define	FRAGBAD		2	/*  can't be kept			*/
+#define	FRAGDONE	3	/*  recorded and ready to keep		*/
+#define	FRAGUSED	4	/*  read from the cache			*/
+#define	FRAGTAG		"A85 FRAG 1"	/*  first line of a fragment file	*/
+#define	FRAGLINE	(2 * MAXLINE + 64)	/*  longest fragment file line	*/
+
+typedef struct {
+    unsigned name;	/*  offset of symbol name in text pool		*/
+    unsigned attr[4];	/*  attribute word, 0 if undefined		*/
+    unsigned valu[4];	/*  value					*/
+    char late;		/*  touched in pass 2 only			*/
+} DEP;
+
+#define	PRE1		0	/*  symbol state before pass 1		*/
+#define	POST1		1	/*  symbol state after pass 1		*/
+#define	PRE2		2	/*  symbol state before pass 2		*/
+#define	POST2		3	/*  symbol state after pass 2		*/
+
+/*  Main program (A85.C) assembly jobs and library interface:		*/
+
+#include "a85lib.h"
+
 /*  Lexical analyzer (A85EVAL.C) token buffer and stream pointer:	*/
 
 typedef struct {
     unsigned attr;
     unsigned valu;
-    char sval[MAXLINE + 1];
+    struct _symbol *sym;	/*  symbol table entry, if any	*/
+    char *sval;			/*  string value, if any	*/
 } TOKEN;
 
 /*  Lexical analyzer (A85EVAL.C) token attribute values:		*/
@@ -335,6 +574,145 @@ typedef struct {
 #define	VAL		4	/*  value				*/
 #define	REG		5	/*  register designator			*/
 
+/*  Lexical analyzer (A85EVAL.C) token store.  The operand field of	*/
+/*  each source line is scanned once into the store, and lex() hands	*/
+/*  the stored tokens out from there.  A symbol reference is stored by	*/
+/*  name and looked up when it is handed out, since its value may be	*/
+/*  different by then.  String values are kept in a string pool.	*/
+
+typedef struct {
+    unsigned attr;	/*  attribute word, SYMREF, or PCREF		*/
+    unsigned valu;
+    unsigned sval;	/*  offset of string value in string pool	*/
+    struct _symbol *sym;	/*  symbol table entry, once found	*/
+    unsigned prog;	/*  compiled expression starting here, if any	*/
+    char err;		/*  error found while scanning, if any		*/
+} STOKEN;
+
+#define	SYMREF		6	/*  stored only:  symbol reference	*/
+#define	PCREF		7	/*  stored only:  $			*/
+
+/*  A token store handed from one thread to another.  The receiving	*/
+/*  thread only reads it.						*/
+
+typedef struct {
+    STOKEN *toks;	/*  stored tokens				*/
+    char *strs;		/*  string pool					*/
+    unsigned *prog;	/*  compiled expressions			*/
+    unsigned ntoks;	/*  number of stored tokens			*/
+    unsigned nstrs;	/*  size of string pool				*/
+} TSTORE;
+
+/*  Line assembler (A85.C) pass 2 parts.  With -t, pass 1 keeps a	*/
+/*  checkpoint of the assembler's state every PARTSIZE lines.  Pass 2	*/
+/*  is then split at the checkpoints into parts that worker threads	*/
+/*  assemble at once, each into a line store of its own.  Workers only	*/
+/*  read the symbol table, so a line that defines its label is flagged	*/
+/*  DEFINED and the main thread marks the symbol.  Once every part is	*/
+/*  found to end in the state that the next part began with, the parts	*/
+/*  are sent to the listing and hex file drivers in order.  Otherwise,	*/
+/*  pass 2 is done over in order.					*/
+
+#define	PARTSIZE	4096	/*  lines between checkpoints		*/
+#define	MAXTHREADS	64	/*  most threads for pass 2		*/
+
+typedef struct {
+    unsigned rec;	/*  record of the next line			*/
+    unsigned pc;	/*  value of $					*/
+    unsigned pagelen;	/*  page length					*/
+    int off;		/*  assembly turned off				*/
+    int ifsp;		/*  IF stack pointer				*/
+    int ifstack[IFDEPTH];	/*  IF stack				*/
+    char title[MAXLINE];	/*  title				*/
+} CHECK;
+
+typedef struct {
+    CHECK start;	/*  state before the first line			*/
+    CHECK end;		/*  state after the last line			*/
+    unsigned last;	/*  record after the last line			*/
+    JOB *job;		/*  job being assembled				*/
+    RECORD *records;	/*  pass 1 line records				*/
+    char *text;		/*  pass 1 text pool				*/
+    TSTORE tokens;	/*  main thread's token store			*/
+    LINE *lines;	/*  lines assembled				*/
+    unsigned nlines;	/*  number of lines assembled			*/
+    unsigned char *code;	/*  their object bytes			*/
+    char *titles;	/*  their titles				*/
+    unsigned ntitles, maxtitles;
+    unsigned errors;	/*  errors found				*/
+    int pcused;		/*  $ was used					*/
+    int done;		/*  END was reached				*/
+    int fail;		/*  part can't be assembled on its own		*/
+#ifdef	PTHREADS
+    pthread_t thread;	/*  worker thread				*/
+    int started;	/*  worker thread was started			*/
+#endif
+} PART;
+
+/*  Line assembler (A85.C) include pre-scan.  With -t, the files that	*/
+/*  the main source INCLUDEs are read and run through pass 1 by worker	*/
+/*  threads before pass 1 starts, each file on its own from $ = 0.  A	*/
+/*  file with nothing but instructions, DB, DW, and DS of a number	*/
+/*  comes out of pass 1 the same wherever it is INCLUDEd, but for the	*/
+/*  values of its labels.  Pass 1 takes such a file's line records	*/
+/*  and tokens as they are, enters its labels at their offsets plus	*/
+/*  the value of $ at the INCLUDE, and moves $ on by the file's size.	*/
+/*  Any other file is read and assembled by pass 1 as it always was.	*/
+
+typedef struct {
+    SOURCE file;	/*  file name and text, once read		*/
+    int taken;		/*  text was handed to the source cache		*/
+    int ok;		/*  pass 1 can take the file as it is		*/
+    RECORD *records;	/*  its line records				*/
+    unsigned nrecs;	/*  number of line records			*/
+    unsigned *offs;	/*  offset of $ from the start at each line	*/
+    unsigned maxoffs;
+    char *text;		/*  its text pool				*/
+    TSTORE tokens;	/*  its token store				*/
+    unsigned size;	/*  bytes it takes up				*/
+} SCAN;
+
+typedef struct {
+    SCAN *scans;	/*  files to pre-scan				*/
+    unsigned nscans;	/*  number of files				*/
+    unsigned next;	/*  next file to be taken			*/
+#ifdef	PTHREADS
+    pthread_mutex_t lock;	/*  guards next				*/
+#endif
+} SCANS;
+
+/*  Line assembler (A85.C) include prefetch.  An I/O thread reads the	*/
+/*  files named by INCLUDE lines into memory ahead of pass 1, and the	*/
+/*  files that those INCLUDE in turn.  When pass 1 comes to the		*/
+/*  INCLUDE, the text is handed to the source cache rather than read	*/
+/*  then.  A file that the thread hasn't come to yet is read by pass 1	*/
+/*  as it always was.							*/
+
+typedef struct {
+    SOURCE file;	/*  file name and text, once read		*/
+    int state;		/*  see below					*/
+} FETCH;
+
+#define	FQUEUED		0	/*  waiting to be read			*/
+#define	FREADING	1	/*  being read				*/
+#define	FREAD		2	/*  read, text not yet used		*/
+#define	FFAILED		3	/*  didn't open or couldn't be read	*/
+#define	FCLAIMED	4	/*  left for pass 1 to read		*/
+#define	FTAKEN		5	/*  text handed to the source cache	*/
+
+typedef struct {
+    FETCH *fetches;	/*  files to read				*/
+    unsigned nfetches, maxfetches;
+    unsigned next;	/*  next file to be read			*/
+    int stop;		/*  stop reading				*/
+#ifdef	PTHREADS
+    int started;	/*  I/O thread was started			*/
+    pthread_t thread;	/*  I/O thread					*/
+    pthread_mutex_t lock;	/*  guards all of the above		*/
+    pthread_cond_t ready;	/*  a file was read			*/
+#endif
+} FETCHES;
+
 /*  Lexical analyzer (A85EVAL.C) token attribute word flag masks:	*/
 
 #define	BINARY		0x8000	/*  Operator:	is binary operator	*/
@@ -351,6 +729,14 @@ typedef struct {
 
 #define	TYPE		0x000f	/*  All:	token type		*/
 
+/*  Lexical analyzer (A85EVAL.C) character class flag masks:		*/
+
+#define	CALPHA		0x01	/*  can start a symbol or operator	*/
+#define	CDIGIT		0x02	/*  decimal digit			*/
+#define	CHEX		0x04	/*  hexadecimal digit			*/
+#define	CBLANK		0x08	/*  blank space				*/
+#define	CALNUM		(CALPHA + CDIGIT)
+
 /*  Lexical analyzer (A85EVAL.C) operator token values (unlisted ones	*/
 /*  use ASCII characters):						*/
 
@@ -387,25 +773,102 @@ typedef struct {
 struct _symbol {
     unsigned attr;
     unsigned valu;
-    struct _symbol *left, *right;
+    unsigned hash;
+    unsigned mark;	/*  last include fragment to touch it		*/
+    unsigned def;	/*  record of its first definition in pass 1	*/
     char sname[1];
 };
 
 typedef struct _symbol SYMBOL;
 
 #define	SYMCOLS		4
+#define	SYMINIT		1024	/*  initial symbol hash table size	*/
+#define	ARENASIZE	65536	/*  size of symbol arena chunks		*/
+
+/*  Alignment unit for blocks carved from the symbol arena:		*/
+
+typedef union {
+    long l;
+    double d;
+    void *p;
+} ALIGN;
 
 /*  Utility package (A85UTIL.C) opcode/operator table routines:		*/
 
-typedef struct {
+typedef struct _opcode {
     unsigned attr;
     unsigned valu;
     char oname[7];
 } OPCODE;
 
+/*  Utility package (A85UTIL.C) listing routines.  The lines of the	*/
+/*  listing are packed into blocks as items, each a header followed by	*/
+/*  the object bytes and the source text, the title, or nothing.  The	*/
+/*  listing writer takes the blocks from a ring and formats them.	*/
+
+#define	LBLOCK		16384	/*  size of listing block	*/
+#define	LBLOCKS		8	/*  blocks in the ring		*/
+#define	LLINE		0	/*  a source line		*/
+#define	LTITLE		1	/*  a new title			*/
+#define	LERRS		2	/*  the error count		*/
+#define	LSYMS		3	/*  the symbol table, last	*/
+#define	LSTOP		4	/*  nothing more, last		*/
+
+typedef struct {
+    char kind;			/*  see above			*/
+    char errcode;		/*  error code of line		*/
+    char listhex;		/*  list address and bytes	*/
+    char eject;			/*  new page before line	*/
+    unsigned address;		/*  address shown in listing	*/
+    unsigned bytes;		/*  object bytes that follow	*/
+    unsigned len;		/*  length of text, or count	*/
+    unsigned pagelen;		/*  page length, or 0		*/
+} LITEM;
+
+typedef struct {
+    FILE *fp;			/*  file, or NULL if not open	*/
+    char *blk[LBLOCKS];		/*  ring of blocks		*/
+    unsigned len[LBLOCKS];	/*  bytes of items in block	*/
+    unsigned max[LBLOCKS];	/*  size of block		*/
+    unsigned head, tail;	/*  blocks handed over, done	*/
+    int failed;			/*  a write failed, as handed back	*/
+    int error;			/*  a write failed, at the writer	*/
+    int col;			/*  symbol table column		*/
+    unsigned listleft;		/*  lines left on page		*/
+    unsigned pagelen;		/*  page length, or 0		*/
+    SYMBOL **stab;		/*  symbols to list		*/
+    unsigned ssize, scount;	/*  table size, symbols in it	*/
+    char title[MAXLINE];	/*  title at the writer		*/
+    char sent[MAXLINE];		/*  title last handed over	*/
+#ifdef	PTHREADS
+    int threaded;		/*  writer has a thread		*/
+    pthread_t thread;		/*  writer thread		*/
+    pthread_mutex_t lock;	/*  guards head and tail	*/
+    pthread_cond_t more, room;	/*  block ready, block free	*/
+#endif
+} LISTING;
+
 /*  Utility package (A85UTIL.C) hex file output routines:		*/
 
-#define	HEXSIZE		32
+#define	HEXSIZE		32	/*  default record length	*/
+#define	HEXMAX		255	/*  longest record length	*/
+#define	SRECMAX		252	/*  longest S-record length	*/
+#define	HEXREC		(2 * HEXMAX + 12)	/*  longest record	*/
+#define	HEXBUF		8192	/*  size of output block	*/
+#define	DATAREC		0	/*  data record type		*/
+#define	ENDREC		1	/*  end of file record type	*/
+#define	HEADREC		2	/*  S-record header record type	*/
+
+typedef struct {
+    FILE *fp;			/*  file, or NULL if not open	*/
+    int srec;			/*  Motorola S-records, not Intel HEX	*/
+    unsigned hlen;		/*  characters in block buffer	*/
+    char hbuf[HEXBUF];		/*  formed records		*/
+} RECFILE;
+
+/*  Utility package (A85UTIL.C) binary image output routines:		*/
+
+#define	FILLBYTE	0xff		/*  default gap fill byte	*/
 
 
 
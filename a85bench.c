@@ -0,0 +1,129 @@
+/* A85 Cross Assembler in Portable C
+ *
+ * Copyright (c) 1985,1987 William C. Colley, III
+ * Copyright (c) 2013 Herb Johnson
+ * Copyright (c) 2020 The Glitch Works
+ *
+ * This is a modified version of William C. Colley III's A85 cross assembler
+ * in "portable C." Modifications included from Herb Johnson and The Glitch
+ * Works. See README in project root for more information.
+ * 
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* This file contains a microbenchmark for the opcode and operator lookups.
+It times the perfect hash lookup that find_code() and find_operator() use
+against the binary search with a case-folding compare that they used before,
+over a mix of names like the ones the lexical analyzer feeds them:  opcodes
+in both cases, register names, and labels that are in neither table.  Run it
+with "make bench". */
+
+/*  Get global goodies:  */
+
+#include "a85.h"
+#include "a85tbl.h"
+#include "a85hash.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define	ROUNDS		200000L
+
+static OPCODE *bccsearch(OPCODE *, OPCODE *, char *);
+static int ustrcmp(char *, char *);
+static double timeit(int);
+
+/*  Each lookup is stored here, so that the loop can't be optimized	*/
+/*  away.								*/
+
+OPCODE * volatile sink;
+
+static char *names[] = {
+    "MOV", "mvi", "LXI", "Jmp", "CALL", "ret", "DB", "dw", "EQU", "INCLUDE",
+    "A", "b", "H", "SP", "psw", "M", "AND", "shl", "HIGH", "low",
+    "LOOP", "START", "L00123", "BUFFER", "Delay1", "TABLE_END", "x", "?TMP",
+    NULL
+};
+
+int main(void)
+{
+    SCRATCH double told, tnew;
+    SCRATCH char **p;
+
+    for (p = names; *p; ++p)
+	if (bccsearch(opctbl,opctbl + OPCOUNT,*p) !=
+		nfind(opctbl,opcslot,OPCSIZE,OPCSEED,*p) ||
+	    bccsearch(oprtbl,oprtbl + OPRCOUNT,*p) !=
+		nfind(oprtbl,oprslot,OPRSIZE,OPRSEED,*p)) {
+	    printf("Lookup mismatch on \"%s\"\n",*p);
+	    exit(1);
+	}
+
+    told = timeit(0);  tnew = timeit(1);
+    printf("binary search:  %6.1f ns/lookup\n",told);
+    printf("perfect hash:   %6.1f ns/lookup\n",tnew);
+    printf("speedup:        %6.1fx\n",told / tnew);
+    return 0;
+}
+
+/*  Time ROUNDS passes over the names, looking each one up in both	*/
+/*  tables as the lexical analyzer and line assembler would.		*/
+
+static double timeit(int hashed)
+{
+    SCRATCH clock_t t;
+    SCRATCH long n, k;
+    SCRATCH char **p;
+
+    t = clock();
+    for (n = k = 0; n < ROUNDS; ++n)
+	for (p = names; *p; ++p, k += 2)
+	    if (hashed) {
+		sink = nfind(opctbl,opcslot,OPCSIZE,OPCSEED,*p);
+		sink = nfind(oprtbl,oprslot,OPRSIZE,OPRSEED,*p);
+	    }
+	    else {
+		sink = bccsearch(opctbl,opctbl + OPCOUNT,*p);
+		sink = bccsearch(oprtbl,oprtbl + OPRCOUNT,*p);
+	    }
+    return (double)(clock() - t) * 1e9 / CLOCKS_PER_SEC / k;
+}
+
+/*  The binary search and compare that find_code() and find_operator()	*/
+/*  used before the perfect hash tables.				*/
+
+static OPCODE *bccsearch(OPCODE *lo, OPCODE *hi, char *nam)
+
+{
+    SCRATCH int i;
+    SCRATCH OPCODE *chk;
+
+    for (;;) {
+	chk = lo + (hi - lo) / 2;
+	if (!(i = ustrcmp(chk -> oname,nam))) return chk;
+	if (chk == lo) return NULL;
+	if (i < 0) lo = chk;
+	else hi = chk;
+    }
+}
+
+static int ustrcmp(char *s, char *t)
+
+{
+    SCRATCH int i;
+
+    while (!(i = toupper(*s++) - toupper(*t)) && *t++);
+    return i;
+}
@@ -37,7 +37,14 @@ arithmetic expressions.
 
 #include "a85.h"
 #include <ctype.h>
+#include <stdlib.h>
 #include <string.h>
+#ifdef	SERVER
+#include <sys/stat.h>
+#ifdef	PTHREADS
+#include <pthread.h>
+#endif
+#endif
 
 /* from A18eval.c HRJ */
 /* local  prototypes HRJ*/
@@ -45,18 +52,21 @@ static unsigned eval(unsigned);
 static void exp_error(char);
 void unlex(void);
 TOKEN *lex(void);
-static void make_number(unsigned);
+static void scan(void);
+static void make_number(STOKEN *, char *, unsigned);
+static unsigned save_str(char *);
 int popc(void);
+static int getsc(void), skipsc(void), ends(char *), field(char *, char *);
+static void endline(void);
 void pushc(char);
 int isalph(char); /* was isalph(int) HRJ */
-static int isnum(char), ischar(char), ishex(char);
-static int isalpnum(char c);
 
 /* external prototypes HRJ*/
 void error(char);
 void pops(char *), trash(void);
-OPCODE *find_operator(char *);
+OPCODE *find_code(char *), *find_operator(char *);
 SYMBOL *find_symbol(char *);
+void *grow(void *, unsigned *, unsigned, unsigned);
 
 void asm_line(void);
 void lclose(void), lopen(char *), lputs(void);
@@ -65,45 +75,94 @@ void error(char), fatal_error(char *), warning(char *);
 void hseek(unsigned);
 void unlex(void);
 void suppress(void);
+int later(SYMBOL *);
 /* above from A68eval.c HRJ */
 
 
 
 /*  Get access to global mailboxes defined in A85.C:			*/
 
-extern char lline[]; //HRJ was line[] in A85.c
-extern int filesp, forwd, pass;
-extern unsigned pc;
-extern FILE *filestk[], *source;
-extern TOKEN token;
+extern TLOCAL char *lline; //HRJ was line[] in A85.c
+extern TLOCAL int filesp, forwd, onepass, pass, pending, pcused;
+extern TLOCAL unsigned llen, pc;
+extern TLOCAL INPUT filestk[], *source;
+extern TLOCAL TOKEN token;
+
+/*  Character class table.  Each source character is classified by a	*/
+/*  single lookup rather than by a chain of comparisons.  Characters	*/
+/*  above '~' and control characters other than \t fall in no class.	*/
+
+#define	AL	CALPHA
+#define	DG	(CDIGIT + CHEX)
+#define	HX	(CALPHA + CHEX)
+#define	BL	CBLANK
+
+static unsigned char cclass[256] = {
+/*	NUL  SOH  STX  ETX  EOT  ENQ  ACK  BEL  BS   HT   LF   VT   FF   CR   SO   SI	*/
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   BL,  0,   0,   0,   0,   0,   0,
+/*	DLE  DC1  DC2  DC3  DC4  NAK  SYN  ETB  CAN  EM   SUB  ESC  FS   GS   RS   US	*/
+	0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+/*	SP   !    "    #    $    %    &    '    (    )    *    +    ,    -    .    /	*/
+	BL,  AL,  0,   AL,  AL,  AL,  AL,  0,   0,   0,   0,   0,   0,   0,   AL,  0,
+/*	0    1    2    3    4    5    6    7    8    9    :    ;    <    =    >    ?	*/
+	DG,  DG,  DG,  DG,  DG,  DG,  DG,  DG,  DG,  DG,  AL,  0,   0,   0,   0,   AL,
+/*	@    A    B    C    D    E    F    G    H    I    J    K    L    M    N    O	*/
+	AL,  HX,  HX,  HX,  HX,  HX,  HX,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,
+/*	P    Q    R    S    T    U    V    W    X    Y    Z    [    \    ]    ^    _	*/
+	AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,
+/*	`    a    b    c    d    e    f    g    h    i    j    k    l    m    n    o	*/
+	AL,  HX,  HX,  HX,  HX,  HX,  HX,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,
+/*	p    q    r    s    t    u    v    w    x    y    z    {    |    }    ~    DEL	*/
+	AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  AL,  0
+};
+
+#undef	AL
+#undef	DG
+#undef	HX
+#undef	BL
+
+#define	isnum(c)	(cclass[(c) & 0377] & CDIGIT)
+#define	ishex(c)	(cclass[(c) & 0377] & CHEX)
+#define	isalpnum(c)	(cclass[(c) & 0377] & CALNUM)
+#define	isblnk(c)	(cclass[(c) & 0377] & CBLANK)
 
 /*  Expression analysis routine.  The token stream from the lexical	*/
 /*  analyzer is processed as an arithmetic expression and reduced to an	*/
 /*  unsigned value.  If an error occurs during the evaluation, the	*/
 /*  global flag	forwd is set to indicate to the line assembler that it	*/
 /*  should not base certain decisions on the result of the evaluation.	*/
-
-static int bad;
-
-unsigned expr()
-{
-	SCRATCH unsigned u;
-	// unsigned eval();
-
-	bad = FALSE;
-	u = eval(START);
-	return bad ? 0 : u;
-}
+/*  In single-pass mode, the lexical analyzer also sets the global flag	*/
+/*  pending when it meets a symbol that is not yet defined.		*/
+/*									*/
+/*  The first time an expression is evaluated, it is also compiled	*/
+/*  into a postfix program with its constant parts folded, and the	*/
+/*  program is kept with the expression's first stored token.  Later	*/
+/*  evaluations of the same tokens, in pass 2 or by a single-pass	*/
+/*  fixup, run the program instead (see expr() below).  An expression	*/
+/*  with a syntax error is never compiled, so that its errors are	*/
+/*  found again just as before.						*/
+
+static TLOCAL int bad;
+static TLOCAL unsigned *prog = NULL;
+static TLOCAL unsigned nprog = 0, maxprog = 0;
+static TLOCAL int compiling, nocode;
+
+static void emit(unsigned), operand(void);
+static void unary(unsigned, unsigned, unsigned);
+static void binary(unsigned, unsigned, unsigned, unsigned);
+static unsigned binop(unsigned, unsigned, unsigned);
 
 static unsigned eval(pre)
 unsigned pre;
 {
-	register unsigned op, u, v;
+	register unsigned op, u, v, first, mid;
 	// TOKEN *lex();
 	// void exp_error(), unlex();
 
+	first = nprog;
 	for (;;) {
 	u = op = lex() -> valu;
+	if (compiling) operand();
 	switch (token.attr & TYPE) {
 		case REG:	exp_error('S');  break;
 
@@ -113,6 +172,7 @@ unsigned pre;
 		case OPR:	if (!(token.attr & UNARY)) { exp_error('E');  break; }
 			// HRJ was u = eval((op == '+' || op == '-') ?
 						//      (unsigned) UOP1 : token.attr & PREC);
+			if (op == '*') pcused = TRUE;
 			u = (op == '*' ? pc :
 				eval((op == '+' || op == '-') ?
 				(unsigned) UOP1 : token.attr & PREC)); //HRJ from a68eval.c
@@ -125,6 +185,7 @@ unsigned pre;
 
 				case LOW:	u = low(u);  break;
 			}
+			if (compiling) unary(op,first,u);
 
 		case VAL:
 		case STR:	for (;;) {
@@ -145,120 +206,341 @@ unsigned pre;
 						if ((token.attr & PREC) >= pre) {
 						unlex();  return u;
 						}
-						if (op != ')')
+						if (op == ')') {
+						if (pre == LPREN) return u;
+						exp_error('(');
+						break;
+						}
+						mid = nprog;
 						v = eval(token.attr & PREC);
-						switch (op) {
-						case '+':   u += v;  break;
+						u = binop(op,u,v);
+						if (compiling) binary(op,first,mid,u);
+						break;
+				}
+			}
+			break;
+	}
+	}
+}
+
+/*  Binary operator routine.  Returns u op v, cut to 16 bits.  A shift	*/
+/*  count over 15 is an error.						*/
 
-						case '-':   u -= v;  break;
+static unsigned binop(unsigned op, unsigned u, unsigned v)
+{
+	switch (op) {
+		case '+':   u += v;  break;
 
-						case '*':   u *= v;  break;
+		case '-':   u -= v;  break;
 
-						case '/':   u /= v;  break;
+		case '*':   u *= v;  break;
 
-						case MOD:   u %= v;  break;
+		case '/':   u /= v;  break;
 
-						case AND:   u &= v;  break;
+		case MOD:   u %= v;  break;
 
-						case OR:    u |= v;  break;
+		case AND:   u &= v;  break;
 
-						case XOR:   u ^= v;  break;
+		case OR:    u |= v;  break;
 
-						case '<':   u = u < v;  break;
+		case XOR:   u ^= v;  break;
 
-						case LE:    u = u <= v;  break;
+		case '<':   u = u < v;  break;
 
-						case '=':   u = u == v;  break;
+		case LE:    u = u <= v;  break;
 
-						case GE:    u = u >= v;  break;
+		case '=':   u = u == v;  break;
 
-						case '>':   u = u > v;  break;
+		case GE:    u = u >= v;  break;
 
-						case NE:    u = u != v;  break;
+		case '>':   u = u > v;  break;
 
-						case SHL:   if (v > 15)
-								exp_error('E');
-								else u <<= v;
-								break;
+		case NE:    u = u != v;  break;
 
-						case SHR:   if (v > 15)
-								exp_error('E');
-								else u >>= v;
-								break;
+		case SHL:   if (v > 15)
+				exp_error('E');
+				else u <<= v;
+				break;
 
-						case ')':   if (pre == LPREN)
-								return u;
-								exp_error('(');
-								break;
-						}
-						clamp(u);
-						break;
-				}
-			}
-			break;
-	}
+		case SHR:   if (v > 15)
+				exp_error('E');
+				else u >>= v;
+				break;
 	}
+	return clamp(u);
 }
 
 static void exp_error(char c)
 
 {
-	forwd = bad = TRUE;  error(c);
+	forwd = bad = nocode = TRUE;  error(c);
 }
 
 /*  Lexical analyzer.  The source input character stream is chopped up	*/
-/*  into its component parts and the pieces are evaluated.  Symbols are	*/
-/*  looked up, operators are looked up, etc.  Everything gets reduced	*/
+/*  into its component parts and the pieces are evaluated.  Operators	*/
+/*  are looked up, numbers are converted, etc.  Everything gets reduced	*/
 /*  to an attribute word, a numeric value, and (possibly) a string	*/
-/*  value.								*/
+/*  value.  The operand field of a source line is scanned all at once	*/
+/*  by tokenize() into the token store, and lex() hands the tokens out	*/
+/*  one at a time from there, looking up symbols as it goes.  Pass 2	*/
+/*  and single-pass fixups replay the stored tokens without scanning	*/
+/*  the source again.							*/
 
-static int oldt = FALSE;
-static int quote = FALSE;
+static TLOCAL int oldt = FALSE;
+static TLOCAL int quote = FALSE;
+static TLOCAL int oldc, eol;	/*  pushed back character, end of line	*/
 
 /* Allow suppression of UNDEFINED LABEL error for one lex */
-static int suppress_undefined = FALSE;
+static TLOCAL int suppress_undefined = FALSE;
+
+/*  The token store and string pool are growable arrays drawn from the	*/
+/*  heap.  Offset 0 in the string pool is always the empty string.	*/
+
+static TLOCAL STOKEN *toks = NULL;
+static TLOCAL char *strs = NULL;
+static TLOCAL unsigned ntoks = 0, nstrs = 0, maxtoks = 0, maxstrs = 0;
+static TLOCAL unsigned tpos;		/*  index of next token to hand out	*/
+static TLOCAL unsigned last;		/*  index of last token handed out	*/
+static TLOCAL int shared;		/*  store belongs to another thread	*/
+
+static unsigned symref(STOKEN *);
 
 TOKEN *lex(void)
 {
-	SCRATCH char c, *p; // HRJ d not needed
+	SCRATCH STOKEN *t;
+
+	/* SYMBOL *find_symbol();
+	void exp_error(); */
+
+	if (oldt) { oldt = FALSE;  return &token; }
+	if (((t = toks + (last = tpos)) -> attr & TYPE) != EOL) ++tpos;
+	token.attr = t -> attr;  token.valu = t -> valu;
+	token.sval = strs + t -> sval;  token.sym = NULL;
+	if (t -> err) exp_error(t -> err);
+
+	switch (t -> attr) {
+		case PCREF:	token.attr = VAL;  token.valu = pc;  pcused = TRUE;  break;
+
+		case SYMREF:	token.attr = VAL;  token.valu = symref(t);
+				token.sym = t -> sym;
+				break;
+	}
+	suppress_undefined = FALSE;	/* good for this token only */
+	return &token;
+}
+
+/*  Symbol reference routine.  Returns the value of the stored symbol	*/
+/*  reference, or 0 if the symbol isn't defined.  The symbol is looked	*/
+/*  up only until it has been found.					*/
+
+static unsigned symref(STOKEN *t)
+{
+	SCRATCH SYMBOL *s;
+
+	if (!t -> sym && !shared) t -> sym = find_symbol(strs + t -> sval);
+
+	if ((s = t -> sym)) {
+		if (pass == 2 && s -> attr & FORWD && (!shared || later(s))) forwd = TRUE;
+		return s -> valu;
+	}
+	else if (onepass) {
+		/* May be defined later, caller keeps a fixup */
+		forwd = pending = TRUE;
+	} else if (suppress_undefined) {
+		/* Allow it through for one lex */
+	} else {
+		/* Whether a symbol is defined changes from pass to pass, */
+		/* so this doesn't keep the expression from being compiled */
+		forwd = bad = TRUE;  error('U');
+	}
+	return 0;
+}
+
+/*  Expression program store.  A program is a string of words:  XPUSH	*/
+/*  and a value, XSYM and the index of a stored symbol reference, XPC,	*/
+/*  a unary operator, or XBIN plus a binary operator's token value.	*/
+/*  XEND and the index of the token that ended the expression finish	*/
+/*  it.  A stored token's prog is 0 until its expression is compiled,	*/
+/*  NOCODE if it can't be, and otherwise the program's offset plus 2.	*/
+
+#define	XEND		0
+#define	XPUSH		1
+#define	XSYM		2
+#define	XPC		3
+#define	XNEG		4
+#define	XNOT		5
+#define	XHIGH		6
+#define	XLOW		7
+#define	XBIN		8
+#define	NOCODE		1
+
+static void emit(unsigned w)
+{
+	prog = grow(prog,&maxprog,nprog + 1,sizeof(unsigned));
+	prog[nprog++] = w;
+}
+
+/*  Compile the operand that lex() just handed out, if it is one.	*/
+
+static void operand(void)
+{
+	SCRATCH STOKEN *t;
+
+	if ((token.attr & TYPE) != VAL && (token.attr & TYPE) != STR) return;
+	t = toks + last;
+	if (t -> attr == SYMREF) { emit(XSYM);  emit(last); }
+	else if (t -> attr == PCREF) emit(XPC);
+	else { emit(XPUSH);  emit(token.valu); }
+}
+
+/*  Compile a unary operator whose operand starts at the given offset.	*/
+/*  If the operand is a constant, the result u replaces it.		*/
+
+static void unary(unsigned op, unsigned first, unsigned u)
+{
+	if (op == '*') { emit(XPC);  return; }
+	if (op != '-' && op != NOT && op != HIGH && op != LOW) return;
+	if (nprog == first + 2 && prog[first] == XPUSH) prog[first + 1] = u;
+	else emit(op == '-' ? XNEG : op == NOT ? XNOT : op == HIGH ? XHIGH : XLOW);
+}
+
+/*  Compile a binary operator whose operands start at the given		*/
+/*  offsets.  If both are constants, the result u replaces them.	*/
+
+static void binary(unsigned op, unsigned first, unsigned mid, unsigned u)
+{
+	if (mid == first + 2 && prog[first] == XPUSH &&
+		nprog == mid + 2 && prog[mid] == XPUSH) {
+		nprog = first;  emit(XPUSH);  emit(u);
+	}
+	else emit(XBIN + op);
+}
+
+/*  Expression routine.  The expression that starts with the next	*/
+/*  token is run from its program if it has one, or else evaluated	*/
+/*  and compiled.  Running the program leaves the token that ended the	*/
+/*  expression pushed back, just as evaluating it does.  If the first	*/
+/*  token was pushed back by unlex(), it has already been handed out,	*/
+/*  so a symbol there isn't looked at again.				*/
+
+static unsigned run(unsigned *, int);
+
+unsigned expr()
+{
+	SCRATCH unsigned u, i, first, *p;
+
+	bad = FALSE;
+	i = oldt ? last : tpos;
+	if (toks[i].prog > NOCODE) {
+		p = prog + toks[i].prog - 2;
+		u = run(p,oldt && p[0] == XSYM && p[1] == i);
+	}
+	else {
+		compiling = !toks[i].prog && !shared;  nocode = FALSE;  first = nprog;
+		u = eval(START);
+		if (compiling) {
+			if (nocode) { nprog = first;  toks[i].prog = NOCODE; }
+			else { emit(XEND);  emit(last);  toks[i].prog = first + 2; }
+			compiling = FALSE;
+		}
+	}
+	return bad ? 0 : u;
+}
+
+/*  Expression program interpreter.  The program works a stack of	*/
+/*  values with no recursion.  If held is set, the value of the symbol	*/
+/*  that the program starts with is taken from the token already	*/
+/*  handed out.								*/
+
+static unsigned run(unsigned *p, int held)
+{
+	SCRATCH unsigned *sp, v;
+	static TLOCAL unsigned stack[MAXLINE];
+
+	sp = stack;
+	if (held) { *sp++ = token.valu;  p += 2; }
+	for (;;)
+		switch (*p++) {
+			case XPUSH:	*sp++ = *p++;  break;
+
+			case XSYM:	*sp++ = symref(toks + *p++);  break;
+
+			case XPC:	*sp++ = pc;  pcused = TRUE;  break;
+
+			case XNEG:	sp[-1] = word(0 - sp[-1]);  break;
+
+			case XNOT:	sp[-1] ^= 0xffff;  break;
+
+			case XHIGH:	sp[-1] = high(sp[-1]);  break;
+
+			case XLOW:	sp[-1] = low(sp[-1]);  break;
+
+			case XEND:	tpos = *p;  oldt = FALSE;  lex();  unlex();
+					return sp[-1];
+
+			default:	v = *--sp;
+					sp[-1] = binop(p[-1] - XBIN,sp[-1],v);
+					break;
+		}
+}
+
+/*  Scan the rest of the current source line into the token store.	*/
+/*  The store always ends the line with an EOL token.  Returns the	*/
+/*  index of the line's first token and readies lex() to hand it out.	*/
+
+unsigned tokenize(void)
+{
+	SCRATCH unsigned first;
+
+	first = ntoks;
+	do scan(); while ((toks[ntoks - 1].attr & TYPE) != EOL);
+	tpos = first;  oldt = FALSE;
+	return first;
+}
+
+/*  Ready lex() to hand out the stored tokens starting at the given	*/
+/*  index.								*/
+
+void retoken(unsigned i)
+{
+	tpos = i;  oldt = FALSE;
+	return;
+}
+
+/*  Scan one token from the source line into the token store.  Errors	*/
+/*  found while scanning are kept with the token and reported when	*/
+/*  lex() hands it out, just as if the token had been scanned then.	*/
+
+static void scan(void)
+{
+	SCRATCH char c, *p;
 	SCRATCH unsigned b;
 	SCRATCH OPCODE *o;
-	SCRATCH SYMBOL *s;
+	SCRATCH STOKEN *t;
+	static TLOCAL char sbuf[MAXLINE + 1];
 
 	/* OPCODE *find_operator();
-	SYMBOL *find_symbol();
-	void exp_error(), make_number(), pops(), pushc(), trash(); */
+	void make_number(), pops(), pushc(), trash(); */
 
-	if (oldt) { oldt = FALSE;  return &token; }
+	toks = grow(toks,&maxtoks,ntoks + 1,sizeof(STOKEN));
+	t = toks + ntoks++;
+	t -> valu = t -> sval = t -> prog = 0;  t -> sym = NULL;  t -> err = '\0';
 	trash();
 	if (isalph(c = popc())) {
-		pushc(c);  pops(token.sval);
-		if (!strcmp(token.sval,"$")) {
-			token.attr = VAL;
-			token.valu = pc;
-		}
-		else if ((o = find_operator(token.sval))) {
-			token.attr = o -> attr;
-			token.valu = o -> valu;
+		pushc(c);  pops(sbuf);
+		if (!strcmp(sbuf,"$")) t -> attr = PCREF;
+		else if ((o = find_operator(sbuf))) {
+			t -> attr = o -> attr;
+			t -> valu = o -> valu;
 		}
 		else {
-			token.attr = VAL;  token.valu = 0;
-
-			if ((s = find_symbol(token.sval))) {
-				token.valu = s -> valu;
-				if (pass == 2 && s -> attr & FORWD) forwd = TRUE;
-			}
-			else if (suppress_undefined) {
-				/* Allow it through for one lex */
-				suppress_undefined = FALSE;
-			} else {
-				exp_error('U');
-			}
+			t -> attr = SYMREF;
+			t -> sval = save_str(sbuf);
 		}
 	}
 	else if (isnum(c)) {
-	pushc(c);  pops(token.sval);
-	for (p = token.sval; *p; ++p);
+	pushc(c);  pops(sbuf);
+	for (p = sbuf; *p; ++p);
 	switch (toupper(*--p)) {
 		case 'B':	b = 2;  break;
 
@@ -270,51 +552,51 @@ TOKEN *lex(void)
 
 		case 'H':	b = 16;  break;
 	}
-	*p = '\0';  make_number(b);
+	*p = '\0';  make_number(t,sbuf,b);
 	}
 	else switch (c) {
 		//HRJ a68 has %, @, $, #  cases
 
-	case '(':   token.attr = UNARY + LPREN + OPR;
+	case '(':   t -> attr = UNARY + LPREN + OPR;
 			goto opr1;
 
-	case ')':   token.attr = BINARY + RPREN + OPR;
+	case ')':   t -> attr = BINARY + RPREN + OPR;
 			goto opr1;
 
-	case '+':   token.attr = BINARY + UNARY + ADDIT + OPR;
+	case '+':   t -> attr = BINARY + UNARY + ADDIT + OPR;
 			goto opr1;
 
-	case '-':   token.attr = BINARY + UNARY + ADDIT + OPR;
+	case '-':   t -> attr = BINARY + UNARY + ADDIT + OPR;
 			goto opr1;
 
-	case '*':   token.attr = BINARY + UNARY + MULT + OPR;
+	case '*':   t -> attr = BINARY + UNARY + MULT + OPR;
 			goto opr1;
 
-	case '/':   token.attr = BINARY + MULT + OPR;
-opr1:		    token.valu = c;
+	case '/':   t -> attr = BINARY + MULT + OPR;
+opr1:		    t -> valu = c;
 			break;
 
-	case '<':   token.valu = c;
-			if ((c = popc()) == '=') token.valu = LE;
-			else if (c == '>') token.valu = NE;
+	case '<':   t -> valu = c;
+			if ((c = popc()) == '=') t -> valu = LE;
+			else if (c == '>') t -> valu = NE;
 			else pushc(c);
 			goto opr2;
 
-	case '=':   token.valu = c;
-			if ((c = popc()) == '<') token.valu = LE;
-			else if (c == '>') token.valu = GE;
+	case '=':   t -> valu = c;
+			if ((c = popc()) == '<') t -> valu = LE;
+			else if (c == '>') t -> valu = GE;
 			else pushc(c);
 			goto opr2;
 
-	case '>':   token.valu = c;
-			if ((c = popc()) == '<') token.valu = NE;
-			else if (c == '=') token.valu = GE;
+	case '>':   t -> valu = c;
+			if ((c = popc()) == '<') t -> valu = NE;
+			else if (c == '=') t -> valu = GE;
 			else pushc(c);
-opr2:		    token.attr = BINARY + RELAT + OPR;
+opr2:		    t -> attr = BINARY + RELAT + OPR;
 			break;
 
 	case '\'':
-	case '"':   quote = TRUE;  token.attr = STR;
+	case '"':   quote = TRUE;  t -> attr = STR;
 			//HRJ following different in a68eval.c
 			// for (p = token.sval; ; ++p) {
 			// if ((d = popc()) == '\n') { exp_error('"');  break; }
@@ -324,65 +606,152 @@ opr2:		    token.attr = BINARY + RELAT + OPR;
 					//HRJ I think this is a problem because popc() is evoked twice per FOR loop
 					// but only pushc() once after breaking loop. May miss newline.
 			//HRJ replaced above with following from a68eval.c
-			for (p = token.sval; (*p = popc()) != c; ++p)
-			   if (*p == '\n') { exp_error('"');  break; }
+			for (p = sbuf; (*p = popc()) != c; ++p)
+			   if (*p == '\n') { t -> err = '"';  break; }
 			//HRJ end of replacement. This fixed problem where expressions like
 			//	DB<tab>"B";<crlf> or DB<tab>"B"<tab>;comment were "E" errors
 			*p = '\0';  quote = FALSE;
-			if ((token.valu = token.sval[0]) && token.sval[1])
-			token.valu = (token.valu << 8) + token.sval[1];
+			if ((t -> valu = sbuf[0]) && sbuf[1])
+			t -> valu = (t -> valu << 8) + sbuf[1];
+			t -> sval = save_str(sbuf);
 			break;
 
-	case ',':   token.attr = SEP;
+	case ',':   t -> attr = SEP;
 			break;
 
-		case '\n':  token.attr = EOL;
+		case '\n':  t -> attr = EOL;
 			break;
 	}
-	return &token;
+	return;
 }
 
-static void make_number(base)
-unsigned base;
+static void make_number(STOKEN *t, char *s, unsigned base)
 {
 	SCRATCH char *p;
 	SCRATCH unsigned d;
-	/* void exp_error(); */
 
-	token.attr = VAL;
-	token.valu = 0;
-	for (p = token.sval; *p; ++p) {
+	t -> attr = VAL;
+	t -> valu = 0;
+	for (p = s; *p; ++p) {
 	d = toupper(*p) - (isnum(*p) ? '0' : 'A' - 10);
-	token.valu = token.valu * base + d;
-	if (!ishex(*p) || d >= base) { exp_error('D');  break; }
+	t -> valu = t -> valu * base + d;
+	if (!ishex(*p) || d >= base) { t -> err = 'D';  break; }
 	}
-	clamp(token.valu);
+	clamp(t -> valu);
 	return;
 }
 
-int isalph(char c) // HRJ slightly different from a68eval.c
+/*  Copy a string value into the string pool and return its offset.	*/
+
+static unsigned save_str(char *s)
+{
+	SCRATCH unsigned n;
+
+	if (!nstrs) { strs = grow(strs,&maxstrs,1,1);  strs[nstrs++] = '\0'; }
+	if (!*s) return 0;
+	n = strlen(s) + 1;
+	strs = grow(strs,&maxstrs,nstrs + n,1);
+	memcpy(strs + nstrs,s,n);
+	return (nstrs += n) - n;
+}
+
+/*  Token store handoff routines.  Before the store is handed to pass	*/
+/*  2 worker threads, every symbol reference is looked up, since a	*/
+/*  worker has no symbol table of its own.  A worker that uses the	*/
+/*  store neither compiles expressions into it nor looks symbols up,	*/
+/*  and asks the line assembler whether a symbol is still a forward	*/
+/*  reference where it is used.  Handing the worker NULL gives the	*/
+/*  store back.								*/
+
+void link_tokens(TSTORE *ts)
+{
+	SCRATCH STOKEN *t;
+
+	for (t = toks; t < toks + ntoks; ++t)
+		if (t -> attr == SYMREF && !t -> sym) t -> sym = find_symbol(strs + t -> sval);
+	ts -> toks = toks;  ts -> strs = strs;  ts -> prog = prog;
+}
+
+void use_tokens(TSTORE *ts)
+{
+	if ((shared = ts != NULL)) {
+		toks = ts -> toks;  strs = ts -> strs;  prog = ts -> prog;
+	}
+	else { toks = NULL;  strs = NULL;  prog = NULL; }
+	oldt = suppress_undefined = FALSE;
+}
+
+/*  Include pre-scan routines.  A pre-scan worker takes the token	*/
+/*  store it filled, leaving its own empty.  Pass 1 adds the store to	*/
+/*  the end of its own, with the string values moved along with it.	*/
+/*  The symbol references are looked up again, and the expressions	*/
+/*  compiled again, by the thread that uses them.  add_tokens()	*/
+/*  returns the index that the first added token ends up at.		*/
+
+void take_tokens(TSTORE *ts)
+{
+	ts -> toks = toks;  ts -> strs = strs;  ts -> prog = NULL;
+	ts -> ntoks = ntoks;  ts -> nstrs = nstrs;
+	free(prog);
+	toks = NULL;  strs = NULL;  prog = NULL;
+	ntoks = nstrs = maxtoks = maxstrs = tpos = 0;
+	nprog = maxprog = 0;
+	oldt = quote = suppress_undefined = FALSE;
+}
 
+unsigned add_tokens(TSTORE *ts)
 {
-	return (c >= '@' && c <= '~') || (c >= '#' && c <= '&') ||
-	c == '!' || c == '.' || c == ':' || c == '?';
+	SCRATCH STOKEN *t;
+	SCRATCH unsigned first, base;
+
+	if (!nstrs) save_str("");
+	base = nstrs - 1;
+	if (ts -> nstrs > 1) {
+		strs = grow(strs,&maxstrs,nstrs + ts -> nstrs - 1,1);
+		memcpy(strs + nstrs,ts -> strs + 1,ts -> nstrs - 1);
+		nstrs += ts -> nstrs - 1;
+	}
+
+	first = ntoks;
+	toks = grow(toks,&maxtoks,ntoks + ts -> ntoks,sizeof(STOKEN));
+	for (t = ts -> toks; t < ts -> toks + ts -> ntoks; ++t) {
+		toks[ntoks] = *t;
+		if (t -> sval) toks[ntoks].sval += base;
+		toks[ntoks].sym = NULL;  toks[ntoks++].prog = 0;
+	}
+	return first;
 }
 
-static int isnum(char c)
+/*  Returns TRUE if the stored tokens from the given index to the end	*/
+/*  of the line hold no symbol reference and no $, so that the value	*/
+/*  of the expression there can't depend on where the line is.		*/
 
+int plain(unsigned i)
 {
-	return c >= '0' && c <= '9';
+	SCRATCH STOKEN *t;
+
+	for (t = toks + i; (t -> attr & TYPE) != EOL; ++t)
+		if (t -> attr == SYMREF || t -> attr == PCREF) return FALSE;
+	return TRUE;
 }
 
-static int ishex(char c)
+/*  Token store teardown routine.  The store and the string pool go	*/
+/*  back to the heap.							*/
 
+void clear_tokens(void)
 {
-	return isnum(c) || ((c = toupper(c)) >= 'A' && c <= 'F');
+	free(toks);  free(strs);  free(prog);
+	toks = NULL;  strs = NULL;  prog = NULL;
+	ntoks = nstrs = maxtoks = maxstrs = tpos = 0;
+	nprog = maxprog = 0;
+	oldt = quote = suppress_undefined = FALSE;
+	return;
 }
 
-static int isalpnum(char c) //HRJ changed to avoid ctype.h conflict
+int isalph(char c) // HRJ slightly different from a68eval.c
 
 {
-	return isalph(c) || isnum(c);
+	return cclass[c & 0377] & CALPHA;
 }
 
 /*  Push back the current token into the input stream.  One level of	*/
@@ -394,16 +763,38 @@ void unlex()
 	return;
 }
 
+/*  Return the type of the next token that lex() will hand out without	*/
+/*  handing it out.							*/
+
+unsigned peek(void)
+{
+	return (oldt ? token.attr : toks[tpos].attr) & TYPE;
+}
+
+/*  Return TRUE if anything but the end of line is left in the current	*/
+/*  line.  A token pushed back by unlex() has already been read from	*/
+/*  the line, so it doesn't count.					*/
+
+int extra(void)
+{
+	return (toks[tpos].attr & TYPE) != EOL;
+}
+
 /*  Get an alphanumeric string into the string value part of the	*/
 /*  current token.  Leading blank space is trashed.			*/
 
 void pops(s)
 char *s;
 {
+	SCRATCH char *p;
 	// void pushc(), trash();
 
 	trash();
-	for (; isalpnum(*s = popc()); ++s);
+	for (; isalpnum(*s = popc()); ++s) {
+		/* Copy the rest of a plain run straight from the source copy */
+		for (p = source -> pos; isalpnum(*p); *++s = *p++);
+		source -> pos = p;
+	}
 	pushc(*s);  *s = '\0';
 	return;
 }
@@ -415,6 +806,7 @@ void trash()
 	SCRATCH char c;
 	// void pushc();
 
+	if (!oldc && !eol) while (isblnk(*source -> pos)) ++source -> pos;
 	while ((c = popc()) == ' ');
 	pushc(c);
 	return;
@@ -423,11 +815,9 @@ void trash()
 /*  Get character from input stream.  This routine does a number of	*/
 /*  other things while it's passing back characters.  All control	*/
 /*  characters except \t and \n are ignored.  \t is mapped into ' '.	*/
-/*  Semicolon is mapped to \n.  In addition, a copy of all input is set	*/
-/*  up in a line buffer for the benefit of the listing.			*/
-
-static int oldc, eol;
-static char *lptr;
+/*  Semicolon is mapped to \n.  In addition, the span of the source	*/
+/*  file copy that holds the line is marked for the benefit of the	*/
+/*  listing.								*/
 
 int popc(void)
 {
@@ -436,20 +826,131 @@ int popc(void)
 	if (oldc) { c = oldc;  oldc = '\0';  return c; }
 	if (eol) return '\n';
 	for (;;) {
-	if ((c = getc(source)) != EOF && (c &= 0377) == ';' && !quote) {
-		do *lptr++ = c;
-		while ((c = getc(source)) != EOF && (c &= 0377) != '\n');
-	}
+	if ((c = getsc()) == ';' && !quote) c = skipsc();
 	if (c == EOF) c = '\n';
 	// HRJ could try if (c == '!' && !quote) { lptr ="!\n\0"
 	// to treat ! as instruction seperator, force scan to break line
 	// but too hard to force scanner to deal with opr!opr
-	if ((*lptr++ = c) >= ' ' && c <= '~') return c;
-	if (c == '\n') { eol = TRUE;  *lptr = '\0';  return '\n'; }
+	if (c >= ' ' && c <= '~') return c;
+	if (c == '\n') { endline();  return '\n'; }
 	if (c == '\t') return quote ? '\t' : ' ';
 	}
 }
 
+/*  Get raw character from the current source file.  Like getc(), this	*/
+/*  sets the end-of-file flag only when a read goes past the end.	*/
+
+static int getsc(void)
+{
+	if (source -> pos < source -> end) return *source -> pos++ & 0377;
+	source -> eof = TRUE;
+	return EOF;
+}
+
+/*  Skip raw characters through the end of the current source line.	*/
+/*  Returns \n, or EOF if the file ends first.  This is the one long	*/
+/*  run the scanner skips, so it goes to memchr(), which the C library	*/
+/*  vectorizes.  The runs of blanks and symbol characters that trash()	*/
+/*  and pops() skip are a few characters long (2.5 for a symbol and	*/
+/*  1.5 for blanks on average in TEST85.ASM), too short for vector	*/
+/*  compares to pay.							*/
+
+static int skipsc(void)
+{
+	SCRATCH char *p;
+
+	if ((p = memchr(source -> pos,'\n',source -> end - source -> pos))) {
+		source -> pos = p + 1;
+		return '\n';
+	}
+	source -> pos = source -> end;  source -> eof = TRUE;
+	return EOF;
+}
+
+/*  Skip the rest of the current source line.				*/
+
+void skipline(void)
+{
+	if (!eol) {
+		oldc = '\0';
+		skipsc();
+		endline();
+	}
+	return;
+}
+
+/*  Skip a line of a false IF block without reading it character by	*/
+/*  character.  The line is skipped only if its label field is empty	*/
+/*  or holds a plain label, and its opcode field is empty or names an	*/
+/*  opcode that is not a conditional.  Such a line can't change the	*/
+/*  IF stack or draw an error, so only its end needs to be found.	*/
+/*  Returns FALSE, with nothing read, for any other line.		*/
+
+static TLOCAL char lbuf[MAXLINE + 1];	/*  label or opcode field	*/
+
+int skipoff(void)
+{
+	SCRATCH char *p, *q;
+	SCRATCH OPCODE *o;
+
+	if (oldc || eol || (p = source -> pos) >= source -> end) return FALSE;
+
+	if (isalph(*p)) {
+		for (q = p; isalpnum(*q); ++q);
+		if (!field(p,q)) return FALSE;
+		if (q[-1] == ':') lbuf[q - p - 1] = '\0';
+		if (find_operator(lbuf)) return FALSE;
+		p = q;
+	}
+
+	else if (!isblnk(*p) && !ends(p)) return FALSE;
+
+	while (isblnk(*p)) ++p;
+	if (!ends(p)) {
+		if (!isalph(*p)) return FALSE;
+		for (q = p; isalpnum(*q); ++q);
+		if (!field(p,q) || !(o = find_code(lbuf)) || o -> attr & ISIF)
+			return FALSE;
+	}
+
+	skipline();
+	return TRUE;
+}
+
+/*  Copy a label or opcode field of skipoff() into its buffer.  Returns	*/
+/*  FALSE if the field might go on past a character that popc() would	*/
+/*  drop, or if it's too long.						*/
+
+static int field(char *p, char *q)
+{
+	SCRATCH char c;
+
+	if ((c = *q) == '\r' ? q[1] != '\n' : !isblnk(c) && (c < ' ' || c > '~') && c != '\n')
+		return FALSE;
+	if (q - p > MAXLINE) return FALSE;
+	memcpy(lbuf,p,q - p);  lbuf[q - p] = '\0';
+	return TRUE;
+}
+
+/*  Returns TRUE if the source line ends at p.  A carriage return	*/
+/*  before the newline is dropped by popc() all the same.		*/
+
+static int ends(char *p)
+{
+	return *p == '\n' || *p == ';' || (*p == '\r' && p[1] == '\n');
+}
+
+/*  Note the end of the current source line and mark its span in the	*/
+/*  source copy for the listing.  At end of file, the span takes in the	*/
+/*  newline that follows the copy.					*/
+
+static void endline(void)
+{
+	eol = TRUE;
+	llen = source -> pos - lline + (source -> eof ? 1 : 0);
+	return;
+}
+
 /*  Push character back onto input stream.  Only one level of push-back	*/
 /*  supported.  \0 cannot be pushed back, but nobody would want to.	*/
 
@@ -459,26 +960,376 @@ void pushc(char c)
 	return;
 }
 
+/*  Mark the next token that lex() will hand out.  The returned index	*/
+/*  into the token store can be handed back to retoken() later to hand	*/
+/*  the line's tokens out again from that point.			*/
+
+unsigned lmark()
+{
+	return tpos - (oldt ? 1 : 0);
+}
+
 /*  Begin new line of source input.  This routine returns non-zero if	*/
 /*  EOF	has been reached on the main source file, zero otherwise.	*/
 
 int newline()
 {
-	// void fatal_error();
-
-	oldc = '\0';  lptr = lline;
+	oldc = '\0';
 	oldt = eol = FALSE;
-	while (feof(source)) {
-	if (ferror(source)) fatal_error(ASMREAD);
-	if (filesp) {
-		fclose(source);
-		source = filestk[--filesp];
-	}
+	while (source -> eof) {
+	if (filesp) source = filestk + --filesp;
 	else return TRUE;
 	}
+	lline = source -> pos;  llen = 0;
 	return FALSE;
 }
 
+/*  Ready the lexical analyzer to read a line again from its n	*/
+/*  characters of text at p, through the given input.			*/
+
+void reread(INPUT *in, char *p, unsigned n)
+{
+	in -> text = in -> pos = p;  in -> end = p + n;  in -> eof = FALSE;
+	source = in;
+	oldc = '\0';
+	oldt = eol = FALSE;
+	return;
+}
+
+/*  Source file open routine.  The file is read into the source cache	*/
+/*  unless it is already there, and the input is set to read it from	*/
+/*  the beginning.  Returns FALSE if the file doesn't open.  The name	*/
+/*  of a file that doesn't open is kept in the cache all the same, so	*/
+/*  that the build cache knows it was looked for.  If the file can't	*/
+/*  be read or there's not enough memory to hold it, a fatal error	*/
+/*  occurs.								*/
+
+static TLOCAL SOURCE *files = NULL;
+static TLOCAL unsigned nfiles = 0, maxfiles = 0;
+#ifdef	SERVER
+static char *warmdir = NULL;	/*  set while the server takes requests	*/
+#endif
+
+static SOURCE *new_source(char *);
+static int read_source(SOURCE *);
+#ifdef	SERVER
+static int warm_source(SOURCE *);
+#endif
+
+int open_source(INPUT *in, char *nam)
+{
+	SCRATCH SOURCE *f;
+
+	for (f = files; f < files + nfiles && strcmp(f -> name,nam); ++f);
+
+	if (f == files + nfiles) {
+		f = new_source(nam);
+#ifdef	SERVER
+		if (warmdir && strcmp(nam,STDNAME)) { if (!warm_source(f)) return FALSE; }
+		else
+#endif
+		if (!read_source(f)) return FALSE;
+	}
+
+	else if (!f -> text) return FALSE;
+
+	in -> text = in -> pos = f -> text;
+	in -> end = f -> text + f -> len;
+	in -> eof = FALSE;
+	return TRUE;
+}
+
+/*  Read a file into its source cache entry.  The file name STDNAME	*/
+/*  stands for stdin, which is read to its end.  Returns FALSE if the	*/
+/*  file doesn't open.  The file is copied in rather than mapped,	*/
+/*  since the scanner needs the \n stored past its last byte, and a	*/
+/*  mapped file cut short while in use (the server keeps files from	*/
+/*  one request to the next) would fault, where a copy can't change	*/
+/*  under the assembly.							*/
+
+static int read_source(SOURCE *f)
+{
+	SCRATCH FILE *fp;
+	SCRATCH unsigned max, n;
+
+	if (!strcmp(f -> name,STDNAME)) fp = stdin;
+	else if (!(fp = fopen(f -> name,"r"))) return FALSE;
+	max = 0;
+	do {
+		f -> text = grow(f -> text,&max,f -> len + BUFSIZ + 1,1);
+		f -> len += n = fread(f -> text + f -> len,1,BUFSIZ,fp);
+	} while (n == BUFSIZ);
+	if (ferror(fp)) fatal_error(ASMREAD);
+	if (fp != stdin) fclose(fp);
+	f -> text[f -> len] = '\n';
+	return TRUE;
+}
+
+/*  Source buffer routine.  A copy of the text is put in the source	*/
+/*  cache under the given name, so that open_source() finds it there	*/
+/*  rather than reading the file.  If there's not enough memory to	*/
+/*  hold it, a fatal error occurs.					*/
+
+void add_source(char *nam, char *text, unsigned len)
+{
+	SCRATCH SOURCE *f;
+
+	f = new_source(nam);
+	if (!(f -> text = malloc(len + 1))) fatal_error(LINES);
+	memcpy(f -> text,text,len);
+	f -> text[f -> len = len] = '\n';
+	return;
+}
+
+/*  Include pre-scan file routines.  fetch_source() reads the named	*/
+/*  file as open_source() would, but leaves it out of the source cache	*/
+/*  and never reads stdin.  give_source() puts the file in the cache	*/
+/*  once it is used, and the text then belongs to the cache.  It	*/
+/*  returns FALSE, leaving the text with the caller, if the cache	*/
+/*  already holds a different copy of the file.  Either returns FALSE	*/
+/*  if the file doesn't open.						*/
+
+int fetch_source(SOURCE *f)
+{
+	f -> text = NULL;  f -> len = 0;  f -> warm = FALSE;
+	if (!strcmp(f -> name,STDNAME)) return FALSE;
+#ifdef	SERVER
+	if (warmdir) return warm_source(f);
+#endif
+	return read_source(f);
+}
+
+int give_source(SOURCE *s)
+{
+	SCRATCH SOURCE *f;
+
+	if (!s -> text) return FALSE;
+	for (f = files; f < files + nfiles; ++f)
+		if (!strcmp(f -> name,s -> name)) return f -> text == s -> text;
+
+	f = new_source(s -> name);
+	f -> text = s -> text;  f -> len = s -> len;  f -> warm = s -> warm;
+	return TRUE;
+}
+
+/*  Add an empty entry for the named file to the source cache.	*/
+
+static SOURCE *new_source(char *nam)
+{
+	SCRATCH SOURCE *f;
+
+	files = grow(files,&maxfiles,nfiles + 1,sizeof(SOURCE));
+	f = files + nfiles++;
+	f -> text = NULL;  f -> len = 0;  f -> warm = FALSE;
+	if (!(f -> name = malloc(strlen(nam) + 1))) fatal_error(LINES);
+	strcpy(f -> name,nam);
+	return f;
+}
+
+/*  Source line locator.  Returns the name of the source file that the	*/
+/*  text came from and the number of the line it is on, or NULL if it	*/
+/*  isn't in the source cache.  Lines are counted on from the last	*/
+/*  text located when that is possible, as errors come in file order.	*/
+
+static TLOCAL unsigned lastf;
+static TLOCAL char *lastp = NULL;
+static TLOCAL unsigned lastn;
+
+char *locate(char *p, unsigned *line)
+{
+	SCRATCH SOURCE *f;
+	SCRATCH char *q;
+
+	for (f = files; f < files + nfiles; ++f)
+		if (p >= f -> text && p <= f -> text + f -> len) break;
+	if (f == files + nfiles) { *line = 0;  return NULL; }
+
+	if (!lastp || lastf != f - files || p < lastp) {
+		lastf = f - files;  lastp = f -> text;  lastn = 1;
+	}
+	for (q = lastp; (q = memchr(q,'\n',p - q)); ++q) ++lastn;
+	lastp = p;
+	*line = lastn;
+	return f -> name;
+}
+
+/*  Source cache listing routine.  Returns the source cache and the	*/
+/*  number of files in it.  Files that didn't open have no text.	*/
+
+SOURCE *source_list(unsigned *n)
+{
+	*n = nfiles;
+	return files;
+}
+
+/*  Source cache teardown routine.  Every file copy goes back to the	*/
+/*  heap.								*/
+
+void close_sources(void)
+{
+	SCRATCH SOURCE *f;
+
+	for (f = files; f < files + nfiles; ++f) {
+		free(f -> name);
+		if (!f -> warm) free(f -> text);
+	}
+	free(files);
+	files = NULL;  lastp = NULL;
+	nfiles = maxfiles = 0;
+	return;
+}
+
+#ifdef	SERVER
+
+/*  Warm file cache.  The assembler server (-d) keeps the text of every	*/
+/*  file it reads from one request to the next, so that include files	*/
+/*  shared by many sources are read once.  Files are kept by full path	*/
+/*  name, and a file is read again when its size, modification time	*/
+/*  to the nanosecond, status change time, device, or i-node number has	*/
+/*  changed.  A source cache entry that comes from here shares its	*/
+/*  text rather than copying it.  Text that has been replaced may still	*/
+/*  be in use by another job of the same request, so it is only freed	*/
+/*  by warm_sweep() once the request is over.  The cache is shared by	*/
+/*  every thread, so it is locked while it is looked at or changed.	*/
+
+static WARM *warms = NULL;
+static char **dead = NULL;
+static unsigned nwarms = 0, maxwarms = 0, ndead = 0, maxdead = 0;
+
+#ifdef	PTHREADS
+static pthread_mutex_t warmlock = PTHREAD_MUTEX_INITIALIZER;
+#define	LOCK()		pthread_mutex_lock(&warmlock)
+#define	UNLOCK()	pthread_mutex_unlock(&warmlock)
+#else
+#define	LOCK()
+#define	UNLOCK()
+#endif
+
+static WARM *find_warm(char *), *new_warm(char *);
+static int retire(char *);
+
+/*  Warm file cache startup routine.  Relative file names are taken to	*/
+/*  be in the given directory until the next call.  A NULL directory	*/
+/*  turns the cache off.						*/
+
+void warm_start(char *dir)
+{
+	warmdir = dir;
+}
+
+/*  Find a file in the warm file cache, or copy it into its source	*/
+/*  cache entry and keep it there.  Returns FALSE if the file doesn't	*/
+/*  open.  The file is read with the cache unlocked, so that a fatal	*/
+/*  error doesn't leave it locked.					*/
+
+static int warm_source(SOURCE *f)
+{
+	SCRATCH WARM *w;
+	SCRATCH char *path;
+	struct stat st;
+
+	if (*f -> name == '/') path = f -> name;
+	else {
+		if (!(path = malloc(strlen(warmdir) + strlen(f -> name) + 2)))
+			fatal_error(NOMEM);
+		sprintf(path,"%s/%s",warmdir,f -> name);
+	}
+	if (stat(path,&st)) {
+		if (path != f -> name) free(path);
+		return FALSE;
+	}
+
+	LOCK();
+	if ((w = find_warm(path)) && w -> size == (long) st.st_size &&
+		w -> mtime == (long) st.st_mtime && w -> mnsec == (long) st.st_mtim.tv_nsec &&
+		w -> ctime == (long) st.st_ctime && w -> dev == (unsigned long) st.st_dev &&
+		w -> ino == (unsigned long) st.st_ino) {
+		f -> text = w -> text;  f -> len = w -> len;  f -> warm = TRUE;
+		UNLOCK();
+		if (path != f -> name) free(path);
+		return TRUE;
+	}
+	UNLOCK();
+
+	if (!read_source(f)) {
+		if (path != f -> name) free(path);
+		return FALSE;
+	}
+
+	LOCK();
+	if (!(w = find_warm(path))) w = new_warm(path);
+	else if (!retire(w -> text)) w = NULL;
+	if (w) {
+		w -> text = f -> text;  w -> len = f -> len;
+		w -> size = st.st_size;  w -> mtime = st.st_mtime;
+		w -> mnsec = st.st_mtim.tv_nsec;  w -> ctime = st.st_ctime;
+		w -> dev = st.st_dev;  w -> ino = st.st_ino;
+		f -> warm = TRUE;
+	}
+	UNLOCK();
+	if (path != f -> name) free(path);
+	return TRUE;
+}
+
+/*  Look a full path name up in the warm file cache.  Returns NULL if	*/
+/*  it isn't there.							*/
+
+static WARM *find_warm(char *path)
+{
+	SCRATCH WARM *w;
+
+	for (w = warms; w < warms + nwarms; ++w)
+		if (!strcmp(w -> path,path)) return w;
+	return NULL;
+}
+
+/*  Add an empty entry to the warm file cache.  Returns NULL if there	*/
+/*  isn't enough memory, in which case the file just isn't kept.	*/
+
+static WARM *new_warm(char *path)
+{
+	SCRATCH WARM *w;
+	SCRATCH unsigned n;
+
+	if (nwarms == maxwarms) {
+		n = maxwarms ? 2 * maxwarms : 16;
+		if (!(w = realloc(warms,n * sizeof(WARM)))) return NULL;
+		warms = w;  maxwarms = n;
+	}
+	w = warms + nwarms;
+	if (!(w -> path = malloc(strlen(path) + 1))) return NULL;
+	strcpy(w -> path,path);  w -> text = NULL;
+	++nwarms;
+	return w;
+}
+
+/*  Put replaced text on the list to be freed once the request is	*/
+/*  over.  Returns FALSE if there isn't enough memory to do so.		*/
+
+static int retire(char *text)
+{
+	SCRATCH char **d;
+	SCRATCH unsigned n;
+
+	if (ndead == maxdead) {
+		n = maxdead ? 2 * maxdead : 16;
+		if (!(d = realloc(dead,n * sizeof(char *)))) return FALSE;
+		dead = d;  maxdead = n;
+	}
+	dead[ndead++] = text;
+	return TRUE;
+}
+
+/*  Warm file cache sweep routine.  Text that was replaced during the	*/
+/*  request goes back to the heap.  No job may be running.		*/
+
+void warm_sweep(void)
+{
+	while (ndead) free(dead[--ndead]);
+}
+
+#endif
+
 /***********************************************************
  * suppress() -- Suppress UNDEFINED LABEL errors
  */
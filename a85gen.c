@@ -0,0 +1,88 @@
+/* A85 Cross Assembler in Portable C
+ *
+ * Copyright (c) 1985,1987 William C. Colley, III
+ * Copyright (c) 2013 Herb Johnson
+ * Copyright (c) 2020 The Glitch Works
+ *
+ * This is a modified version of William C. Colley III's A85 cross assembler
+ * in "portable C." Modifications included from Herb Johnson and The Glitch
+ * Works. See README in project root for more information.
+ * 
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* This file contains the perfect hash table generator.  It is run at build
+time to write A85HASH.H to the standard output.  For each of the opcode and
+operator tables, it looks for the smallest power-of-two slot table and a hash
+seed that puts every name in a slot of its own, so that find_code() and
+find_operator() can resolve any name with a single probe and a single
+compare. */
+
+/*  Get global goodies:  */
+
+#define	A85GEN
+#include "a85.h"
+#include "a85tbl.h"
+#include <stdlib.h>
+
+#define	MAXSIZE		4096		/*  largest slot table tried	*/
+#define	TRIES		200000L		/*  seeds tried per table size	*/
+
+static void gen(char *, OPCODE *, unsigned);
+
+int main(void)
+{
+    printf("/*  Perfect hash tables for find_code() and find_operator().\t*/\n");
+    printf("/*  Generated by A85GEN from A85TBL.H -- do not edit.\t\t*/\n");
+    gen("OPC",opctbl,OPCOUNT);
+    gen("OPR",oprtbl,OPRCOUNT);
+    return 0;
+}
+
+/*  Find a seed and slot table size for one table and print them along	*/
+/*  with the slot table.  The seeds are drawn from a fixed sequence so	*/
+/*  that the output is the same on every build.				*/
+
+static void gen(char *name, OPCODE *tbl, unsigned count)
+{
+    static unsigned char slot[MAXSIZE];
+    unsigned size, i;
+    unsigned long seed, h;
+    long n;
+
+    for (size = 2; size < 2 * count; size <<= 1);
+    for (seed = 2166136261UL; size <= MAXSIZE; size <<= 1) {
+	for (n = 0; n < TRIES; ++n) {
+	    seed = (seed * 1103515245UL + 12345UL) & 0xffffffffUL;
+	    for (i = 0; i < size; slot[i++] = 0);
+	    for (i = 0; i < count; ++i) {
+		h = nhash(tbl[i].oname,seed) & (size - 1);
+		if (slot[h]) break;
+		slot[h] = i + 1;
+	    }
+	    if (i == count) goto found;
+	}
+    }
+    fprintf(stderr,"a85gen: no perfect hash found for %s table\n",name);
+    exit(1);
+
+found:
+    printf("\n#define\t%sSIZE\t\t%u\n",name,size);
+    printf("#define\t%sSEED\t\t0x%08lxUL\n\n",name,seed);
+    printf("static unsigned char %sslot[%sSIZE] = {",name[2] == 'C' ? "opc" : "opr",name);
+    for (i = 0; i < size; ++i)
+	printf("%s%3u%s",i % 16 ? " " : "\n    ",slot[i],i + 1 < size ? "," : "");
+    printf("\n};\n");
+}
@@ -0,0 +1,93 @@
+/* A85 Cross Assembler in Portable C
+ *
+ * Copyright (c) 1985,1987 William C. Colley, III
+ * Copyright (c) 2013 Herb Johnson
+ * Copyright (c) 2020 The Glitch Works
+ *
+ * This is a modified version of William C. Colley III's A85 cross assembler
+ * in "portable C." Modifications included from Herb Johnson and The Glitch
+ * Works. See README in project root for more information.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* This file is the interface to the assembler as a library.  A program that
+links with LIBA85.A includes it to describe an assembly job, hand the job to
+a85_assemble(), and pick up the memory image and the diagnostics from the job
+when the assembly is done.  If the library was built with PTHREADS defined,
+several threads can assemble at once, each with a job of its own.  The state
+of an assembly is kept in the assembler's globals, one set per thread, and
+not in the job, so a thread must not start another assembly while one is
+running on it, as from the print callback.  Built without PTHREADS, the
+globals are shared, and the program may run only one assembly at a time. */
+
+#ifndef	A85LIB_H
+#define	A85LIB_H
+
+/*  The size of the 8085 memory image:					*/
+
+#define	IMAGESIZE	0x10000L
+
+/*  A diagnostic for a source line that was flagged with an error.  The	*/
+/*  error codes are the ones shown in the listing (see A85.DOC).	*/
+
+typedef struct {
+    char code;		/*  error code					*/
+    char *file;		/*  source file name, or NULL if none		*/
+    unsigned line;	/*  line number in source file, or 0 if none	*/
+    unsigned address;	/*  address shown in the listing		*/
+    char *text;		/*  source line, without its newline		*/
+} DIAG;
+
+/*  An assembly job.  Each source file to be assembled is a job with	*/
+/*  its own output files and options.  The outcome of the job is left	*/
+/*  in it when the assembly is done.  a85_init() fills in the defaults.	*/
+
+typedef struct {
+    char *src;		/*  source file name				*/
+    char *text;		/*  source text, if not to be read from src	*/
+    unsigned len;	/*  length of source text			*/
+    char *lst;		/*  listing file name, if any			*/
+    char *hex;		/*  hex file name, if any			*/
+    char *bin;		/*  binary file name, if any			*/
+    int onepass;	/*  assemble in a single pass			*/
+    int range;		/*  binary address range given			*/
+    unsigned fill;	/*  binary fill byte				*/
+    unsigned rlo, rhi;	/*  binary address range			*/
+    int diag;		/*  collect diagnostics				*/
+    unsigned char *image;	/*  IMAGESIZE byte image buffer, if any	*/
+    char *cache;	/*  build cache directory, if any		*/
+    char *sym;		/*  symbol image file to write, if any		*/
+    char **syms;	/*  symbol image files to load first		*/
+    unsigned nsyms;	/*  number of symbol image files to load	*/
+    char *dep;		/*  dependency file name, if any		*/
+    char *srec;		/*  S-record file name, if any			*/
+    unsigned reclen;	/*  hex record length, or 0 for the default	*/
+    unsigned threads;	/*  threads for pass 2, or 0 for just this one	*/
+    int verbose;	/*  report why pass 2 wasn't split, if it wasn't	*/
+    void (*print)(char *);	/*  gets PRINT text, warnings, and notes	*/
+
+    unsigned long lo, hi;	/*  addresses code went into, hi not included	*/
+    DIAG *diags;	/*  diagnostics, if collected			*/
+    unsigned ndiags;	/*  number of diagnostics			*/
+    int errors;		/*  error count, or -1 after a fatal error	*/
+    char *fatal;	/*  fatal error message, if any			*/
+} JOB;
+
+void a85_init(JOB *, char *);
+int a85_assemble(JOB *);
+void a85_release(JOB *);
+
+#endif
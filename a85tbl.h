@@ -0,0 +1,211 @@
+/* A85 Cross Assembler in Portable C
+ *
+ * Copyright (c) 1985,1987 William C. Colley, III
+ * Copyright (c) 2013 Herb Johnson
+ * Copyright (c) 2020 The Glitch Works
+ *
+ * This is a modified version of William C. Colley III's A85 cross assembler
+ * in "portable C." Modifications included from Herb Johnson and The Glitch
+ * Works. See README in project root for more information.
+ * 
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of  MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* This file contains the opcode and operator tables and the hash function
+used to look names up in them.  It is included by A85UTIL.C, by the table
+generator A85GEN.C, which builds the perfect hash tables in A85HASH.H at
+build time, and by the lookup benchmark A85BENCH.C.  The tables must be
+included after A85.H. */
+
+/*  Opcode table.  The entries are kept in alphabetic order for the	*/
+/*  benefit of human readers only; lookups go through the hash.		*/
+
+static OPCODE opctbl[] = {
+	{ DATA_8 + 2,				0xce,	"ACI"	},
+	{ SRC_REG + 1,				0x88,	"ADC"	},
+	{ SRC_REG + 1,				0x80,	"ADD"	},
+	{ DATA_8 + 2,				0xc6,	"ADI"	},
+	{ SRC_REG + 1,				0xa0,	"ANA"	},
+	{ DATA_8 + 2,				0xe6,	"ANI"	},
+	{ DATA_16 + 3,				0xcd,	"CALL"	},
+	{ DATA_16 + 3,				0xdc,	"CC"	},
+	{ DATA_16 + 3,				0xfc,	"CM"	},
+	{ NONE + 1,				0x2f,	"CMA"	},
+	{ NONE + 1,				0x3f,	"CMC"	},
+	{ SRC_REG + 1,				0xb8,	"CMP"	},
+	{ DATA_16 + 3,				0xd4,	"CNC"	},
+	{ DATA_16 + 3,				0xc4,	"CNZ"	},
+	{ DATA_16 + 3,				0xf4,	"CP"	},
+	{ DATA_16 + 3,				0xec,	"CPE"	},
+	{ DATA_8 + 2,				0xfe,	"CPI"	},
+	{ DATA_16 + 3,				0xe4,	"CPO"	},
+	{ DATA_16 + 3,				0xcc,	"CZ"	},
+	{ NONE + 1,				0x27,	"DAA"	},
+	{ DAD_REG + 1,				0x09,	"DAD"	},
+	{ PSEUDO,				DB,	"DB"	},
+	{ DST_REG + 1,				0x05,	"DCR"	},
+	{ DAD_REG + 1,				0x0b,	"DCX"	},
+	{ NONE + 1,				0xf3,	"DI"	},
+	{ PSEUDO,				DS,	"DS"	},
+	{ PSEUDO,				DW,	"DW"	},
+	{ NONE + 1,				0xfb,	"EI"	},
+	{ PSEUDO + ISIF,			ELSE,	"ELSE"	},
+	{ PSEUDO,				END,	"END"	},
+	{ PSEUDO + ISIF,			ENDIF,	"ENDIF"	},
+	{ PSEUDO,				EQU,	"EQU"	},
+	{ NONE + 1,				0x76,	"HLT"	},
+	{ PSEUDO + ISIF,			IF,	"IF"	},
+	{ PSEUDO + ISIF,			IFDEF,	"IFDEF"	},
+	{ PSEUDO + ISIF,			IFNDEF,	"IFNDEF"},
+	{ PORT + 2,				0xdb,	"IN"	},
+	{ PSEUDO,				INCL,	"INCL"	},
+	{ PSEUDO,				INCL,	"INCLUDE"},
+	{ DST_REG + 1,				0x04,	"INR"	},
+	{ DAD_REG + 1,				0x03,	"INX"	},
+	{ DATA_16 + 3,				0xda,	"JC"	},
+	{ DATA_16 + 3,				0xfa,	"JM"	},
+	{ DATA_16 + 3,				0xc3,	"JMP"	},
+	{ DATA_16 + 3,				0xd2,	"JNC"	},
+	{ DATA_16 + 3,				0xc2,	"JNZ"	},
+	{ DATA_16 + 3,				0xf2,	"JP"	},
+	{ DATA_16 + 3,				0xea,	"JPE"	},
+	{ DATA_16 + 3,				0xe2,	"JPO"	},
+	{ DATA_16 + 3,				0xca,	"JZ"	},
+	{ DATA_16 + 3,				0x3a,	"LDA"	},
+	{ LDAX_REG + 1,				0x0a,	"LDAX"	},
+	{ DATA_16 + 3,				0x2a,	"LHLD"	},
+	{ DAD_REG + (DATA_16 << 4) + 3,		0x01,	"LXI"	},
+	{ DST_REG + (SRC_REG << 4) + 1,		0x40,	"MOV"	},
+	{ DST_REG + (DATA_8 << 4) + 2,		0x06,	"MVI"	},
+	{ NONE + 1,				0x00,	"NOP"	},
+	{ SRC_REG + 1,				0xb0,	"ORA"	},
+	{ PSEUDO,				ORG,	"ORG"	},
+	{ DATA_8 + 2,				0xf6,	"ORI"	},
+	{ PORT + 2,				0xd3,	"OUT"	},
+	{ PSEUDO,				PAGE,	"PAGE"	},
+	{ NONE + 1,				0xe9,	"PCHL"	},
+	{ POP_REG + 1,				0xc1,	"POP"	},
+	{ PSEUDO,				PRINT,	"PRINT" },
+	{ POP_REG + 1,				0xc5,	"PUSH"	},
+	{ NONE + 1,				0x17,	"RAL"	},
+	{ NONE + 1,				0x1f,	"RAR"	},
+	{ NONE + 1,				0xd8,	"RC"	},
+	{ NONE + 1,				0xc9,	"RET"	},
+	{ NONE + 1,				0x20,	"RIM"	},
+	{ NONE + 1,				0x07,	"RLC"	},
+	{ NONE + 1,				0xf8,	"RM"	},
+	{ NONE + 1,				0xd0,	"RNC"	},
+	{ NONE + 1,				0xc0,	"RNZ"	},
+	{ NONE + 1,				0xf0,	"RP"	},
+	{ NONE + 1,				0xe8,	"RPE"	},
+	{ NONE + 1,				0xe0,	"RPO"	},
+	{ NONE + 1,				0x0f,	"RRC"	},
+	{ RST_NUM + 1,				0xc7,	"RST"	},
+	{ NONE + 1,				0xc8,	"RZ"	},
+	{ SRC_REG + 1,				0x98,	"SBB"	},
+	{ DATA_8 + 2,				0xde,	"SBI"	},
+	{ PSEUDO,				SET,	"SET"	},
+	{ DATA_16 + 3,				0x22,	"SHLD"	},
+	{ NONE + 1,				0x30,	"SIM"	},
+	{ NONE + 1,				0xf9,	"SPHL"	},
+	{ DATA_16 + 3,				0x32,	"STA"	},
+	{ LDAX_REG + 1,				0x02,	"STAX"	},
+	{ NONE + 1,				0x37,	"STC"	},
+	{ SRC_REG + 1,				0x90,	"SUB"	},
+	{ DATA_8 + 2,				0xd6,	"SUI"	},
+	{ PSEUDO,				TITLE,	"TITLE"	},
+	{ NONE + 1,				0xeb,	"XCHG"	},
+	{ SRC_REG + 1,				0xa8,	"XRA"	},
+	{ DATA_8 + 2,				0xee,	"XRI"	},
+	{ NONE + 1,				0xe3,	"XTHL"	}
+};
+
+/*  Operator and register name table.					*/
+
+static OPCODE oprtbl[] = {
+	{ BCDEHLMA + REG,				A,	"A"	},
+	{ BINARY + LOG1  + OPR,				AND,	"AND"	},
+	{ BCDEHLMA + BDHPSW + BDHSP + BD + REG,		B,	"B"	},
+	{ BCDEHLMA + REG,				C,	"C"	},
+	{ BCDEHLMA + BDHPSW + BDHSP + BD + REG,		D,	"D"	},
+	{ BCDEHLMA + REG,				E,	"E"	},
+	{ BINARY + RELAT + OPR,				'=',	"EQ"	},
+	{ BINARY + RELAT + OPR,				GE,	"GE"	},
+	{ BINARY + RELAT + OPR,				'>',	"GT"	},
+	{ BCDEHLMA + BDHPSW + BDHSP + REG,		H,	"H"	},
+	{ UNARY  + UOP3  + OPR,				HIGH,	"HIGH"	},
+	{ BCDEHLMA + REG,				L,	"L"	},
+	{ BINARY + RELAT + OPR,				LE,	"LE"	},
+	{ UNARY  + UOP3  + OPR,				LOW,	"LOW"	},
+	{ BINARY + RELAT + OPR,				'<',	"LT"	},
+	{ BCDEHLMA + REG,				M,	"M"	},
+	{ BINARY + MULT  + OPR,				MOD,	"MOD"	},
+	{ BINARY + RELAT + OPR,				NE,	"NE"	},
+	{ UNARY  + UOP2  + OPR,				NOT,	"NOT"	},
+	{ BINARY + LOG2  + OPR,				OR,	"OR"	},
+	{ BDHPSW + REG,					PSW,	"PSW"	},
+	{ BINARY + MULT  + OPR,				SHL,	"SHL"	},
+	{ BINARY + MULT  + OPR,				SHR,	"SHR"	},
+	{ BDHSP + REG,					SP,	"SP"	},
+	{ BINARY + LOG2  + OPR,				XOR,	"XOR"	}
+};
+
+#define	OPCOUNT		(sizeof(opctbl) / sizeof(OPCODE))
+#define	OPRCOUNT	(sizeof(oprtbl) / sizeof(OPCODE))
+
+/*  Longest name in either table:					*/
+
+#define	NAMEMAX		7
+
+/*  Name hash function.  This is 32-bit FNV-1a over the name with the	*/
+/*  lower case letters folded to upper case by clearing bit 5, which	*/
+/*  leaves no other character looking like a letter.  The seed is	*/
+/*  chosen by A85GEN so that no two names in a table share a slot.	*/
+/*  Names too long to be in either table hash to NOHASH.		*/
+
+#define	NOHASH		0xffffffffUL
+
+static unsigned long nhash(char *nam, unsigned long seed)
+{
+    SCRATCH int i;
+    SCRATCH unsigned long h;
+
+    for (h = seed, i = 0; nam[i]; ++i) {
+	if (i == NAMEMAX) return NOHASH;
+	h = ((h ^ (nam[i] & 0xdf)) * 16777619UL) & 0xffffffffUL;
+    }
+    return h ^ (h >> 16);
+}
+
+/*  Perfect hash lookup.  The name is hashed into the slot table, which	*/
+/*  holds the table index plus one of the only entry that can match.	*/
+/*  One case-insensitive compare settles the question.  A85GEN builds	*/
+/*  the slot tables, so it has no use for this.				*/
+
+#ifndef	A85GEN
+
+static OPCODE *nfind(OPCODE *tbl, unsigned char *slot, unsigned size,
+    unsigned long seed, char *nam)
+{
+    SCRATCH unsigned long h;
+    SCRATCH char *s;
+
+    if ((h = nhash(nam,seed)) == NOHASH || !(h = slot[h & (size - 1)]))
+	return NULL;
+    for (tbl += h - 1, s = tbl -> oname; *s && *s == (*nam & 0xdf); ++s, ++nam);
+    return *s || *nam ? NULL : tbl;
+}
+
+#endif
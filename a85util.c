@@ -43,17 +43,24 @@ This module contains the following utility packages:
 
 	4)  hex file output
 
-	5)  error flagging
+	5)  binary image output
+
+	6)  build cache
+
+	7)  error flagging
 */
 
 /*  Get global goodies:  */
 
 #include "a85.h"
+#include "a85tbl.h"
+#include "a85hash.h"
 #include <string.h> /* HRJ */
 #include <ctype.h>
 // #include <malloc.h> /* for lcc-32 HRJ */
 /* #include <alloc.h> for Turbo C HRJ */
 #include <stdlib.h>
+#include <errno.h>
 
 /*  Make sure that MSDOS compilers using the large memory model know	*/
 /*  that calloc() returns pointer to char as an MSDOS far pointer is	*/
@@ -63,27 +70,67 @@ This module contains the following utility packages:
 
 /*HRJ local declarations */
 
-static OPCODE *bccsearch(OPCODE *, OPCODE *, char *);
-static void list_sym(SYMBOL *);
-static void record(unsigned);
-static void putb(unsigned);
-static int ustrcmp(char *, char*);
-static void check_page(void);
-void warning(char *);
+static void *salloc(unsigned);
+static unsigned hash(char *);
+static void rehash(void);
+static int symcmp(const void *, const void *);
+static void list_sym(LISTING *, SYMBOL *, int);
+static void record(RECFILE *, unsigned, unsigned, unsigned);
+static char *putb(char *, unsigned);
+static void hflush(RECFILE *), rclose(RECFILE *), hclear(void);
+static void ropen(RECFILE *, char *, int, char *, char *);
+static void new_image(void), bclear(void);
+static void check_page(LISTING *, char *);
+static void lsync(void), lformat(LISTING *, LITEM *, unsigned *, char *);
+static char *lroom(unsigned);
+static int lpost(void), lend(int), lblock(LISTING *, char *, unsigned);
+#ifdef	PTHREADS
+static void *lthread(void *);
+#endif
+static void dname(FILE *, char *);
+static FILE *wopen(char *, char *);
+static int wclose(FILE *);
+SOURCE *source_list(unsigned *);
+int open_source(INPUT *, char *);
+void text_hash(char *, char *, char *, unsigned);
+void warning(char *), say(char *);
 void fatal_error(char *);
 
 
 /*  Get access to global mailboxes defined in A85.C:			*/
 
-extern char errcode, lline[], title[];
-extern int eject, listhex;
-extern unsigned address, bytes, errors, listleft, obj[], pagelen;
-
-/*  The symbol table is a binary tree of variable-length blocks drawn	*/
-/*  from the heap with the calloc() function.  The root pointer lives	*/
-/*  here:								*/
-
-static SYMBOL *sroot = NULL;
+extern TLOCAL char errcode, *lline, title[];
+extern TLOCAL int eject, listhex;
+extern TLOCAL unsigned address, bytes, errors, llen, obj[], pagelen;
+extern TLOCAL jmp_buf *bail;
+extern TLOCAL char *fatal;
+extern TLOCAL int watch;
+extern int tostderr;
+void touch(SYMBOL *, char *);
+
+/*  The symbol table is an open-addressed hash table of pointers to	*/
+/*  variable-length blocks carved from the symbol arena.  Each block	*/
+/*  holds the only copy of its name, so two symbol pointers are equal	*/
+/*  exactly when their names are, and the lexical analyzer hands the	*/
+/*  block it found to the line assembler in the token rather than	*/
+/*  making it look the name up again.  Collisions are resolved by	*/
+/*  linear probing.  The table size is a power of two, and the table	*/
+/*  is doubled whenever it gets half full so that probe sequences stay	*/
+/*  short.  Each block keeps the full hash of its name so that most	*/
+/*  mismatches are settled without calling strcmp().  The table and	*/
+/*  its bookkeeping live here:						*/
+
+static TLOCAL SYMBOL **stab = NULL;
+static TLOCAL unsigned ssize = 0, scount = 0;
+
+/*  The symbol arena is a chain of large blocks drawn from the heap	*/
+/*  with malloc().  Symbols are bump-allocated from the newest block	*/
+/*  and are never freed one at a time; clear_symbols() gives back the	*/
+/*  whole chain at once.  The first unit of each block links to the	*/
+/*  block before it.							*/
+
+static TLOCAL ALIGN *arena = NULL;
+static TLOCAL char *apos = NULL, *aend = NULL;
 
 /*  Add new symbol to symbol table.  Returns pointer to symbol even if	*/
 /*  the symbol already exists.  If there's not enough memory to store	*/
@@ -92,217 +139,197 @@ static SYMBOL *sroot = NULL;
 SYMBOL *new_symbol(char *nam)
 
 {
-    SCRATCH int i;
-    SCRATCH SYMBOL **p, *q;
+    SCRATCH unsigned h, i;
+    SCRATCH SYMBOL *q;
     void fatal_error(char *);
 
     /* printf("new_symbol>>%s<<\n",nam);  HRJ diagnostic*/
 
-    for (p = &sroot; (q = *p) && (i = strcmp(nam,q -> sname)); )
-	p = i < 0 ? &(q -> left) : &(q -> right);
+    if (2 * (scount + 1) > ssize) rehash();
+    h = hash(nam);
+    for (i = h & (ssize - 1); (q = stab[i]); i = (i + 1) & (ssize - 1))
+	if (q -> hash == h && !strcmp(nam,q -> sname)) break;
     if (!q) {
-	if (!(*p = q = (SYMBOL *)calloc(1,sizeof(SYMBOL) + strlen(nam))))
-	    fatal_error(SYMBOLS);
+	stab[i] = q = (SYMBOL *)salloc(sizeof(SYMBOL) + strlen(nam));
+	q -> attr = q -> valu = q -> mark = q -> def = 0;  q -> hash = h;
 	strcpy(q -> sname,nam);
+	++scount;
     }
+    if (watch) touch(q,nam);
     return q;
 }
 
 /*  Look up symbol in symbol table.  Returns pointer to symbol or NULL	*/
-/*  if symbol not found.						*/
+/*  if symbol not found.  While an include fragment is being recorded,	*/
+/*  both routines tell it about every symbol they are asked for.	*/
 
 SYMBOL *find_symbol(char *nam)
 
 {
-    SCRATCH int i;
-    SCRATCH SYMBOL *p;
+    SCRATCH unsigned h, i;
+    SCRATCH SYMBOL *q;
+
+    q = NULL;
+    if (stab) {
+	h = hash(nam);
+	for (i = h & (ssize - 1); (q = stab[i]); i = (i + 1) & (ssize - 1))
+	    if (q -> hash == h && !strcmp(nam,q -> sname)) break;
+    }
+    if (watch) touch(q,nam);
+    return q;
+}
 
-    for (p = sroot; p && (i = strcmp(nam,p -> sname));
-	p = i < 0 ? p -> left : p -> right);
-    return p;
+/*  Symbol table teardown routine.  The hash table and every symbol go	*/
+/*  back to the heap, leaving an empty table.				*/
+
+void clear_symbols(void)
+
+{
+    SCRATCH ALIGN *a;
+
+    while ((a = arena)) {
+	arena = (ALIGN *)(a -> p);
+	free(a);
+    }
+    free(stab);
+    stab = NULL;  apos = aend = NULL;  ssize = scount = 0;
+    return;
 }
 
-/*  Opcode table search routine.  This routine pats down the opcode	*/
-/*  table for a given opcode and returns either a pointer to it or	*/
-/*  NULL if the opcode doesn't exist.					*/
+/*  Make room in the symbol table for n more symbols, so that a symbol	*/
+/*  image can be loaded without the table being doubled along the way.	*/
 
-OPCODE *find_code(char *nam)
+void reserve_symbols(unsigned n)
 
 {
-    /* OPCODE *bsearch(); */
-
-    static OPCODE opctbl[] = {
-	{ DATA_8 + 2,				0xce,	"ACI"	},
-	{ SRC_REG + 1,				0x88,	"ADC"	},
-	{ SRC_REG + 1,				0x80,	"ADD"	},
-	{ DATA_8 + 2,				0xc6,	"ADI"	},
-	{ SRC_REG + 1,				0xa0,	"ANA"	},
-	{ DATA_8 + 2,				0xe6,	"ANI"	},
-	{ DATA_16 + 3,				0xcd,	"CALL"	},
-	{ DATA_16 + 3,				0xdc,	"CC"	},
-	{ DATA_16 + 3,				0xfc,	"CM"	},
-	{ NONE + 1,				0x2f,	"CMA"	},
-	{ NONE + 1,				0x3f,	"CMC"	},
-	{ SRC_REG + 1,				0xb8,	"CMP"	},
-	{ DATA_16 + 3,				0xd4,	"CNC"	},
-	{ DATA_16 + 3,				0xc4,	"CNZ"	},
-	{ DATA_16 + 3,				0xf4,	"CP"	},
-	{ DATA_16 + 3,				0xec,	"CPE"	},
-	{ DATA_8 + 2,				0xfe,	"CPI"	},
-	{ DATA_16 + 3,				0xe4,	"CPO"	},
-	{ DATA_16 + 3,				0xcc,	"CZ"	},
-	{ NONE + 1,				0x27,	"DAA"	},
-	{ DAD_REG + 1,				0x09,	"DAD"	},
-	{ PSEUDO,				DB,	"DB"	},
-	{ DST_REG + 1,				0x05,	"DCR"	},
-	{ DAD_REG + 1,				0x0b,	"DCX"	},
-	{ NONE + 1,				0xf3,	"DI"	},
-	{ PSEUDO,				DS,	"DS"	},
-	{ PSEUDO,				DW,	"DW"	},
-	{ NONE + 1,				0xfb,	"EI"	},
-	{ PSEUDO + ISIF,			ELSE,	"ELSE"	},
-	{ PSEUDO,				END,	"END"	},
-	{ PSEUDO + ISIF,			ENDIF,	"ENDIF"	},
-	{ PSEUDO,				EQU,	"EQU"	},
-	{ NONE + 1,				0x76,	"HLT"	},
-	{ PSEUDO + ISIF,			IF,	"IF"	},
-	{ PSEUDO + ISIF,			IFDEF,	"IFDEF"	},
-	{ PSEUDO + ISIF,			IFNDEF,	"IFNDEF"},
-	{ PORT + 2,				0xdb,	"IN"	},
-	{ PSEUDO,				INCL,	"INCL"	},
-	{ PSEUDO,				INCL,	"INCLUDE"},
-	{ DST_REG + 1,				0x04,	"INR"	},
-	{ DAD_REG + 1,				0x03,	"INX"	},
-	{ DATA_16 + 3,				0xda,	"JC"	},
-	{ DATA_16 + 3,				0xfa,	"JM"	},
-	{ DATA_16 + 3,				0xc3,	"JMP"	},
-	{ DATA_16 + 3,				0xd2,	"JNC"	},
-	{ DATA_16 + 3,				0xc2,	"JNZ"	},
-	{ DATA_16 + 3,				0xf2,	"JP"	},
-	{ DATA_16 + 3,				0xea,	"JPE"	},
-	{ DATA_16 + 3,				0xe2,	"JPO"	},
-	{ DATA_16 + 3,				0xca,	"JZ"	},
-	{ DATA_16 + 3,				0x3a,	"LDA"	},
-	{ LDAX_REG + 1,				0x0a,	"LDAX"	},
-	{ DATA_16 + 3,				0x2a,	"LHLD"	},
-	{ DAD_REG + (DATA_16 << 4) + 3,		0x01,	"LXI"	},
-	{ DST_REG + (SRC_REG << 4) + 1,		0x40,	"MOV"	},
-	{ DST_REG + (DATA_8 << 4) + 2,		0x06,	"MVI"	},
-	{ NONE + 1,				0x00,	"NOP"	},
-	{ SRC_REG + 1,				0xb0,	"ORA"	},
-	{ PSEUDO,				ORG,	"ORG"	},
-	{ DATA_8 + 2,				0xf6,	"ORI"	},
-	{ PORT + 2,				0xd3,	"OUT"	},
-	{ PSEUDO,				PAGE,	"PAGE"	},
-	{ NONE + 1,				0xe9,	"PCHL"	},
-	{ POP_REG + 1,				0xc1,	"POP"	},
-	{ PSEUDO,				PRINT,	"PRINT" },
-	{ POP_REG + 1,				0xc5,	"PUSH"	},
-	{ NONE + 1,				0x17,	"RAL"	},
-	{ NONE + 1,				0x1f,	"RAR"	},
-	{ NONE + 1,				0xd8,	"RC"	},
-	{ NONE + 1,				0xc9,	"RET"	},
-	{ NONE + 1,				0x20,	"RIM"	},
-	{ NONE + 1,				0x07,	"RLC"	},
-	{ NONE + 1,				0xf8,	"RM"	},
-	{ NONE + 1,				0xd0,	"RNC"	},
-	{ NONE + 1,				0xc0,	"RNZ"	},
-	{ NONE + 1,				0xf0,	"RP"	},
-	{ NONE + 1,				0xe8,	"RPE"	},
-	{ NONE + 1,				0xe0,	"RPO"	},
-	{ NONE + 1,				0x0f,	"RRC"	},
-	{ RST_NUM + 1,				0xc7,	"RST"	},
-	{ NONE + 1,				0xc8,	"RZ"	},
-	{ SRC_REG + 1,				0x98,	"SBB"	},
-	{ DATA_8 + 2,				0xde,	"SBI"	},
-	{ PSEUDO,				SET,	"SET"	},
-	{ DATA_16 + 3,				0x22,	"SHLD"	},
-	{ NONE + 1,				0x30,	"SIM"	},
-	{ NONE + 1,				0xf9,	"SPHL"	},
-	{ DATA_16 + 3,				0x32,	"STA"	},
-	{ LDAX_REG + 1,				0x02,	"STAX"	},
-	{ NONE + 1,				0x37,	"STC"	},
-	{ SRC_REG + 1,				0x90,	"SUB"	},
-	{ DATA_8 + 2,				0xd6,	"SUI"	},
-	{ PSEUDO,				TITLE,	"TITLE"	},
-	{ NONE + 1,				0xeb,	"XCHG"	},
-	{ SRC_REG + 1,				0xa8,	"XRA"	},
-	{ DATA_8 + 2,				0xee,	"XRI"	},
-	{ NONE + 1,				0xe3,	"XTHL"	}
-    };
-
-    return bccsearch(opctbl,opctbl + (sizeof(opctbl) / sizeof(OPCODE)),nam);
+    while (2 * (scount + n) > ssize) rehash();
+    return;
 }
 
-/*  Operator table search routine.  This routine pats down the		*/
-/*  operator table for a given operator and returns either a pointer	*/
-/*  to it or NULL if the opcode doesn't exist.				*/
+/*  Symbol image writer.  The files in the source cache are listed with	*/
+/*  their hashes, and the defined symbols follow in alphabetic order.	*/
+/*  Returns FALSE if the image can't be written.			*/
 
-OPCODE *find_operator(char *nam)
+int swrite(char *nam)
 
 {
-    /* OPCODE *bsearch(); */
-
-    static OPCODE oprtbl[] = {
-	{ BCDEHLMA + REG,				A,	"A"	},
-	{ BINARY + LOG1  + OPR,				AND,	"AND"	},
-	{ BCDEHLMA + BDHPSW + BDHSP + BD + REG,		B,	"B"	},
-	{ BCDEHLMA + REG,				C,	"C"	},
-	{ BCDEHLMA + BDHPSW + BDHSP + BD + REG,		D,	"D"	},
-	{ BCDEHLMA + REG,				E,	"E"	},
-	{ BINARY + RELAT + OPR,				'=',	"EQ"	},
-	{ BINARY + RELAT + OPR,				GE,	"GE"	},
-	{ BINARY + RELAT + OPR,				'>',	"GT"	},
-	{ BCDEHLMA + BDHPSW + BDHSP + REG,		H,	"H"	},
-	{ UNARY  + UOP3  + OPR,				HIGH,	"HIGH"	},
-	{ BCDEHLMA + REG,				L,	"L"	},
-	{ BINARY + RELAT + OPR,				LE,	"LE"	},
-	{ UNARY  + UOP3  + OPR,				LOW,	"LOW"	},
-	{ BINARY + RELAT + OPR,				'<',	"LT"	},
-	{ BCDEHLMA + REG,				M,	"M"	},
-	{ BINARY + MULT  + OPR,				MOD,	"MOD"	},
-	{ BINARY + RELAT + OPR,				NE,	"NE"	},
-	{ UNARY  + UOP2  + OPR,				NOT,	"NOT"	},
-	{ BINARY + LOG2  + OPR,				OR,	"OR"	},
-	{ BDHPSW + REG,					PSW,	"PSW"	},
-	{ BINARY + MULT  + OPR,				SHL,	"SHL"	},
-	{ BINARY + MULT  + OPR,				SHR,	"SHR"	},
-	{ BDHSP + REG,					SP,	"SP"	},
-	{ BINARY + LOG2  + OPR,				XOR,	"XOR"	}
-    };
-
-    return bccsearch(oprtbl,oprtbl + (sizeof(oprtbl) / sizeof(OPCODE)),nam);
-}
-
-static OPCODE *bccsearch(OPCODE *lo, OPCODE *hi, char *nam)
+    SCRATCH SOURCE *f, *e;
+    SCRATCH SYMBOL **s;
+    SCRATCH FILE *fp;
+    SCRATCH unsigned i, j;
+    SCRATCH int ok;
+    char hash[20];
+    unsigned n;
+
+    s = NULL;
+    if (scount && !(s = (SYMBOL **)malloc(scount * sizeof(SYMBOL *))))
+	fatal_error(NOMEM);
+    for (i = j = 0; i < ssize; ++i) if (stab[i] && stab[i] -> attr) s[j++] = stab[i];
+    qsort(s,j,sizeof(SYMBOL *),symcmp);
+
+    if (!(fp = fopen(nam,"w"))) { free(s);  return FALSE; }
+    f = source_list(&n);
+    fprintf(fp,"%s\n%x %x\n",SYMTAG,n,j);
+    for (e = f + n; f < e; ++f) {
+	if (f -> text) text_hash(hash,NULL,f -> text,f -> len);
+	else strcpy(hash,"----------------");
+	fprintf(fp,"%s %s\n",hash,f -> name);
+    }
+    for (i = 0; i < j; ++i)
+	fprintf(fp,"%c%04x %s\n",s[i] -> attr & SOFT ? 'S' : 'E',s[i] -> valu,
+	    s[i] -> sname);
+    ok = !ferror(fp);
+    if (fclose(fp) == EOF) ok = FALSE;
+    free(s);
+    return ok;
+}
+
+/*  Symbol arena allocator.  A block of the requested size, rounded up	*/
+/*  to the alignment unit, is carved from the newest arena block.  If	*/
+/*  it doesn't fit, a new arena block is started.  If there's not	*/
+/*  enough memory, a fatal error occurs.				*/
+
+static void *salloc(unsigned n)
 
 {
-    SCRATCH int i;
-    SCRATCH OPCODE *chk;
-
-    for (;;) {
-	chk = lo + (hi - lo) / 2;
-	if (!(i = ustrcmp(chk -> oname,nam))) return chk;
-	if (chk == lo) return NULL;
-	if (i < 0) lo = chk;
-	else hi = chk;
+    SCRATCH ALIGN *a;
+    SCRATCH unsigned size;
+
+    n = (n + sizeof(ALIGN) - 1) / sizeof(ALIGN) * sizeof(ALIGN);
+    if (!apos || n > (unsigned)(aend - apos)) {
+	size = n + sizeof(ALIGN) > ARENASIZE ? n + sizeof(ALIGN) : ARENASIZE;
+	if (!(a = (ALIGN *)malloc(size))) fatal_error(SYMBOLS);
+	a -> p = (void *)arena;  arena = a;
+	apos = (char *)(a + 1);  aend = (char *)a + size;
     }
+    apos += n;
+    return apos - n;
 }
 
-static int ustrcmp(char *s, char *t)
+/*  Symbol name hash function (32-bit FNV-1a).				*/
+
+static unsigned hash(char *nam)
 
 {
-    SCRATCH int i;
+    SCRATCH unsigned long h;
 
-    while (!(i = toupper(*s++) - toupper(*t)) && *t++);
-    return i;
+    for (h = 2166136261UL; *nam; h = ((h ^ (*nam++ & 0xff)) * 16777619UL) & 0xffffffffUL);
+    return (unsigned) h;
 }
 
-/*  Buffer storage for line listing routine.  This allows the listing	*/
-/*  output routines to do all operations without the main routine	*/
-/*  having to fool with it.						*/
+/*  Double the size of the symbol hash table and re-enter every symbol.	*/
 
-static FILE *list = NULL;
+static void rehash(void)
+
+{
+    SCRATCH unsigned i, j, n;
+    SCRATCH SYMBOL **old;
+
+    old = stab;  n = ssize;
+    ssize = n ? 2 * n : SYMINIT;
+    if (!(stab = (SYMBOL **)calloc(ssize,sizeof(SYMBOL *)))) fatal_error(SYMBOLS);
+    for (i = 0; i < n; ++i)
+	if (old[i]) {
+	    for (j = old[i] -> hash & (ssize - 1); stab[j]; j = (j + 1) & (ssize - 1));
+	    stab[j] = old[i];
+	}
+    free(old);
+    return;
+}
+
+/*  Opcode table search routine.  This routine pats down the opcode	*/
+/*  table for a given opcode and returns either a pointer to it or	*/
+/*  NULL if the opcode doesn't exist.  The lookup is a single probe of	*/
+/*  the perfect hash table that A85GEN built from the opcode table.	*/
+
+OPCODE *find_code(char *nam)
+
+{
+    return nfind(opctbl,opcslot,OPCSIZE,OPCSEED,nam);
+}
+
+/*  Operator table search routine.  This routine pats down the		*/
+/*  operator table for a given operator and returns either a pointer	*/
+/*  to it or NULL if the opcode doesn't exist.				*/
+
+OPCODE *find_operator(char *nam)
+
+{
+    return nfind(oprtbl,oprslot,OPRSIZE,OPRSEED,nam);
+}
+
+/*  Listing writer.  The lines of the listing are packed into blocks	*/
+/*  as items as lputs() hands them over, so the line assembler doesn't	*/
+/*  have to wait on the listing file.  With PTHREADS defined, a thread	*/
+/*  of the writer's own takes the full blocks from a ring and formats	*/
+/*  them into the listing while the assembly goes on.  Otherwise, or	*/
+/*  if the thread can't be started, each block is formatted as soon as	*/
+/*  it fills.  The writer keeps the paging, the symbol table column,	*/
+/*  and the write error state in the LISTING, and it touches none of	*/
+/*  the thread's mailboxes, so the listing comes out just as if each	*/
+/*  line had been written when it was handed over.			*/
+
+static TLOCAL LISTING lw;
 
 /*  Listing file open routine.  If a listing file is already open, a	*/
 /*  warning occurs.  If the listing file doesn't open correctly, a	*/
@@ -312,189 +339,973 @@ static FILE *list = NULL;
 void lopen(char *nam)
 
 {
-
-    if (list) warning(TWOLST);
-    else if (!(list = fopen(nam,"w"))) fatal_error(LSTOPEN);
+    SCRATCH FILE *f;
+
+    if (lw.fp) warning(TWOLST);
+    else if (!(f = wopen(nam,"w"))) fatal_error(LSTOPEN);
+    else {
+	memset(&lw,0,sizeof(LISTING));
+	lw.fp = f;
+#ifdef	PTHREADS
+	pthread_mutex_init(&lw.lock,NULL);
+	pthread_cond_init(&lw.more,NULL);  pthread_cond_init(&lw.room,NULL);
+	lw.threaded = !pthread_create(&lw.thread,NULL,lthread,&lw);
+#endif
+    }
     return;
 }
 
-/*  Listing file line output routine.  This routine processes the	*/
-/*  source line saved by popc() and the output of the line assembler in	*/
-/*  buffer obj into a line of the listing.  If the disk fills up, a	*/
+/*  Listing file line output routine.  This routine hands the source	*/
+/*  line marked by popc() and the output of the line assembler in	*/
+/*  buffer obj over to the listing writer.  If the disk fills up, a	*/
 /*  fatal error occurs.							*/
 
 void lputs(void)
 {
-    SCRATCH int i, j;
-    SCRATCH unsigned *o;
-    void fatal_error(char *);
-
-    if (list) {
-	i = bytes;  o = obj;
-	do {
-	    fprintf(list,"%c  ",errcode);
-	    if (listhex) {
-		fprintf(list,"%04x  ",address);
-		for (j = 4; j; --j) {
-		    if (i) { --i;  ++address;  fprintf(list," %02x",*o++); }
-		    else fprintf(list,"   ");
-		}
-	    }
-	    else fprintf(list,"%18s","");
-	    fprintf(list,"   %s",lline);  strcpy(lline,"\n");
-	    check_page();
-	    if (ferror(list)) fatal_error(DSKFULL);
-	} while (listhex && i);
+    SCRATCH char *p;
+    LITEM it;
+
+    if (lw.fp) {
+	lsync();
+	it.kind = LLINE;  it.errcode = errcode;  it.listhex = listhex;
+	it.eject = eject;  it.address = address;  it.len = llen;
+	it.bytes = listhex ? bytes : 0;  it.pagelen = pagelen;
+	p = lroom(sizeof(LITEM) + it.bytes * sizeof(unsigned) + llen);
+	memcpy(p,&it,sizeof(LITEM));  p += sizeof(LITEM);
+	memcpy(p,obj,it.bytes * sizeof(unsigned));
+	memcpy(p + it.bytes * sizeof(unsigned),lline,llen);
     }
     return;
 }
 
-/*  Listing file close routine.  The symbol table is appended to the	*/
-/*  listing in alphabetic order by symbol name, and the listing file is	*/
-/*  closed.  If the disk fills up, a fatal error occurs.		*/
-
-static int col = 0;
+/*  Listing file close routine.  The listing writer is handed the	*/
+/*  symbol table to sort and append to the listing in alphabetic order	*/
+/*  by symbol name, and the listing file is closed when the writer is	*/
+/*  done.  The hash table is packed down for the sort and is of no	*/
+/*  further use.  If the disk fills up, a fatal error occurs.		*/
 
 void lerror(void)
 {
-	 if (errors && list) fprintf(list, "%d Error(s)\n",errors); //hrj
+    LITEM it;
+
+    if (errors && lw.fp) { //hrj
+	it.kind = LERRS;  it.len = errors;
+	memcpy(lroom(sizeof(LITEM)),&it,sizeof(LITEM));
+    }
 }
 
 void lclose(void)
 {
-
-    if (list) {
-	if (sroot) {
-	    list_sym(sroot);
-	    if (col) fprintf(list,"\n");
+    if (lw.fp) {
+	lsync();
+	lw.stab = stab;  lw.ssize = ssize;  lw.scount = scount;
+	if (lend(LSYMS) || wclose(lw.fp) == EOF) {
+	    lw.fp = NULL;
+	    fatal_error(DSKFULL);
 	}
-	fprintf(list,"\f");
-	if (ferror(list) || fclose(list) == EOF) fatal_error(DSKFULL);
+	lw.fp = NULL;
+    }
+    return;
+}
+
+static int symcmp(const void *s, const void *t)
+
+{
+    return strcmp((*(SYMBOL **)s) -> sname,(*(SYMBOL **)t) -> sname);
+}
+
+/*  Hand the title over to the listing writer if it has changed since	*/
+/*  it was last handed over.						*/
+
+static void lsync(void)
+{
+    SCRATCH char *p;
+    LITEM it;
+
+    if (strcmp(title,lw.sent)) {
+	strcpy(lw.sent,title);
+	it.kind = LTITLE;  it.len = strlen(title) + 1;
+	p = lroom(sizeof(LITEM) + it.len);
+	memcpy(p,&it,sizeof(LITEM));  memcpy(p + sizeof(LITEM),title,it.len);
     }
     return;
 }
 
-static void list_sym(SYMBOL *sp)
+/*  Make room for an item of n bytes in the block being filled and	*/
+/*  return a pointer to it.  A full block goes to the listing writer	*/
+/*  first.  If the writer has found the disk full, a fatal error	*/
+/*  occurs.								*/
+
+static char *lroom(unsigned n)
+{
+    SCRATCH unsigned b;
+
+    b = lw.head % LBLOCKS;
+    if (lw.len[b] + n > lw.max[b]) {
+	if (lw.len[b]) {
+	    if (lpost()) fatal_error(DSKFULL);
+	    b = lw.head % LBLOCKS;
+	}
+	if (n > lw.max[b]) {
+	    free(lw.blk[b]);
+	    lw.max[b] = n > LBLOCK ? n : LBLOCK;
+	    if (!(lw.blk[b] = (char *)malloc(lw.max[b]))) fatal_error(LINES);
+	}
+    }
+    lw.len[b] += n;
+    return lw.blk[b] + lw.len[b] - n;
+}
+
+/*  Hand the block being filled to the listing writer, and wait until	*/
+/*  the next block in the ring is free.  Returns TRUE if a write has	*/
+/*  failed.								*/
 
+static int lpost(void)
 {
+#ifdef	PTHREADS
+    int failed;
+
+    if (lw.threaded) {
+	pthread_mutex_lock(&lw.lock);
+	++lw.head;
+	pthread_cond_signal(&lw.more);
+	while (lw.head - lw.tail == LBLOCKS) pthread_cond_wait(&lw.room,&lw.lock);
+	failed = lw.failed;
+	pthread_mutex_unlock(&lw.lock);
+	return failed;
+    }
+#endif
+    lblock(&lw,lw.blk[0],lw.len[0]);
+    lw.len[0] = 0;
+    return lw.failed = lw.error;
+}
 
-    if (sp) {
-	list_sym(sp -> left);
-	fprintf(list,"%04x  %-10s",sp -> valu,sp -> sname);
+/*  Hand the last item, LSYMS or LSTOP, to the listing writer and wait	*/
+/*  for the writer to finish.  The blocks go back to the heap.  Returns	*/
+/*  TRUE if a write failed.						*/
 
-	if ((col = (col + 1) % SYMCOLS)) fprintf(list,"    ");
-	else {
-	    fprintf(list,"\n");
-	    if (sp -> right) check_page();
+static int lend(int kind)
+{
+    SCRATCH int i;
+    LITEM it;
+
+    it.kind = kind;
+    if (lw.len[lw.head % LBLOCKS] + sizeof(LITEM) > lw.max[lw.head % LBLOCKS]) lpost();
+    memcpy(lroom(sizeof(LITEM)),&it,sizeof(LITEM));
+    lpost();
+#ifdef	PTHREADS
+    if (lw.threaded) {
+	pthread_join(lw.thread,NULL);
+	lw.threaded = FALSE;
+    }
+    pthread_cond_destroy(&lw.more);  pthread_cond_destroy(&lw.room);
+    pthread_mutex_destroy(&lw.lock);
+#endif
+    for (i = 0; i < LBLOCKS; ++i) { free(lw.blk[i]);  lw.blk[i] = NULL; }
+    return lw.error || ferror(lw.fp);
+}
+
+#ifdef	PTHREADS
+
+/*  Listing writer thread.  Full blocks are taken from the ring and	*/
+/*  formatted in turn until the last item comes.  The write error	*/
+/*  state is handed back with each block.				*/
+
+static void *lthread(void *arg)
+{
+    register LISTING *l;
+    register unsigned b;
+    register int last;
+
+    l = (LISTING *)arg;
+    do {
+	pthread_mutex_lock(&l -> lock);
+	while (l -> tail == l -> head) pthread_cond_wait(&l -> more,&l -> lock);
+	pthread_mutex_unlock(&l -> lock);
+	b = l -> tail % LBLOCKS;
+	last = lblock(l,l -> blk[b],l -> len[b]);
+	pthread_mutex_lock(&l -> lock);
+	l -> failed = l -> error;  l -> len[b] = 0;  ++l -> tail;
+	pthread_cond_signal(&l -> room);
+	pthread_mutex_unlock(&l -> lock);
+    } while (!last);
+    return NULL;
+}
+
+#endif
+
+/*  Format the items of a block into the listing.  After a write fails,	*/
+/*  the items are passed over.  Returns TRUE if the last item came.	*/
+
+static int lblock(LISTING *l, char *p, unsigned n)
+{
+    register char *e;
+    register unsigned i, j;
+    LITEM it;
+    unsigned o[MAXLINE];
+
+    for (e = p + n; p < e; ) {
+	memcpy(&it,p,sizeof(LITEM));  p += sizeof(LITEM);
+	switch (it.kind) {
+	    case LLINE:	memcpy(o,p,it.bytes * sizeof(unsigned));
+			p += it.bytes * sizeof(unsigned);
+			if (!l -> error) lformat(l,&it,o,p);
+			p += it.len;  break;
+
+	    case LTITLE:	memcpy(l -> title,p,it.len);  p += it.len;  break;
+
+	    case LERRS:	if (!l -> error) fprintf(l -> fp,"%d Error(s)\n",it.len);
+			break;
+
+	    case LSYMS:	if (!l -> error) {
+			    if (l -> scount) {
+				for (i = j = 0; i < l -> ssize; ++i)
+				    if (l -> stab[i]) l -> stab[j++] = l -> stab[i];
+				qsort(l -> stab,l -> scount,sizeof(SYMBOL *),symcmp);
+				for (i = 0; i < l -> scount; ++i)
+				    list_sym(l,l -> stab[i],i + 1 < l -> scount);
+				if (l -> col) fprintf(l -> fp,"\n");
+			    }
+			    fprintf(l -> fp,"\f");
+			}
+			return TRUE;
+
+	    case LSTOP:	return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+/*  Format a source line and its object bytes into the listing, four	*/
+/*  bytes to a line.							*/
+
+static void lformat(LISTING *l, LITEM *it, unsigned *o, char *text)
+{
+    register int i, j;
+    register unsigned a, n;
+
+    i = it -> bytes;  a = it -> address;  n = it -> len;
+    l -> pagelen = it -> pagelen;
+    do {
+	fprintf(l -> fp,"%c  ",it -> errcode);
+	if (it -> listhex) {
+	    fprintf(l -> fp,"%04x  ",a);
+	    for (j = 4; j; --j) {
+		if (i) { --i;  ++a;  fprintf(l -> fp," %02x",*o++); }
+		else fprintf(l -> fp,"   ");
+	    }
 	}
-	list_sym(sp -> right);
+	else fprintf(l -> fp,"%18s","");
+	fprintf(l -> fp,"   %.*s",(int) n,text);
+	text = "\n";  n = 1;
+	check_page(l,&it -> eject);
+	if (ferror(l -> fp)) { l -> error = TRUE;  return; }
+    } while (it -> listhex && i);
+    return;
+}
+
+/*  List a symbol in the symbol table at the end of the listing.  Every	*/
+/*  full row but the last counts toward the page, so the table is paged	*/
+/*  like the source lines.  The old symbol tree counted a row only if	*/
+/*  the symbol that ended it had a right subtree, so its pages ran long	*/
+/*  by however many rows it missed.					*/
+
+static void list_sym(LISTING *l, SYMBOL *sp, int more)
+
+{
+    char eject;
+
+    fprintf(l -> fp,"%04x  %-10s",sp -> valu,sp -> sname);
+
+    if ((l -> col = (l -> col + 1) % SYMCOLS)) fprintf(l -> fp,"    ");
+    else {
+	fprintf(l -> fp,"\n");
+	eject = FALSE;
+	if (more) check_page(l,&eject);
     }
     return;
 }
 
-static void check_page(void)
+static void check_page(LISTING *l, char *eject)
 {
-    if (pagelen && !--listleft) eject = TRUE;
-    if (eject) {
-	eject = FALSE;  listleft = pagelen;  fprintf(list,"\f");
-	if (title[0]) { listleft -= 2;  fprintf(list,"%s\n\n",title); }
+    if (l -> pagelen && !--l -> listleft) *eject = TRUE;
+    if (*eject) {
+	*eject = FALSE;  l -> listleft = l -> pagelen;  fprintf(l -> fp,"\f");
+	if (l -> title[0]) { l -> listleft -= 2;  fprintf(l -> fp,"%s\n\n",l -> title); }
     }
     return;
 }
 
-/*  Buffer storage for hex output file.  This allows the hex file	*/
+/*  Buffer storage for hex output files.  This allows the hex file	*/
 /*  output routines to do all of the required buffering and record	*/
-/*  forming without the	main routine having to fool with it.		*/
+/*  forming without the	main routine having to fool with it.  The	*/
+/*  bytes are laid into a 64K image as they come, and a bitmap keeps	*/
+/*  track of which addresses have been written, so that a byte that	*/
+/*  lands on one already written can be caught.  The records are	*/
+/*  formed when the file is closed, in address order, as long as the	*/
+/*  record length allows and without a break where the code was only	*/
+/*  moved by ORG or DS.  The Intel HEX file and the Motorola S-record	*/
+/*  file are formed alike from the image, each in a block buffer of	*/
+/*  its own that goes to disk with one fwrite() when it fills up.  Each	*/
+/*  byte value is converted to its two hex digits with a single table	*/
+/*  lookup.  That and the checksum come to under a fifth of the		*/
+/*  time taken to write a full 64K image, so vector code for them	*/
+/*  would gain little.							*/
+
+static TLOCAL RECFILE hex, srec;
+static TLOCAL unsigned char *himage = NULL;
+static TLOCAL unsigned char hused[IMAGESIZE / 8];
+static TLOCAL unsigned haddr = 0;
+static TLOCAL unsigned hsize = HEXSIZE;
+static TLOCAL int hmarked = FALSE;
+static TLOCAL char hexpair[2 * 256];
+
+/*  Hex file open routines.  If a file of the kind is already open, a	*/
+/*  warning occurs.  If the file doesn't open correctly or there's not	*/
+/*  enough memory for the image, a fatal error occurs.  If no hex file	*/
+/*  is open, hclose() has no effect.					*/
 
-static FILE *hex = NULL;
-static unsigned cnt = 0;
-static unsigned addr = 0;
-static unsigned sum = 0;
-static unsigned buf[HEXSIZE];
+void hopen(char *nam)
 
-/*  Hex file open routine.  If a hex file is already open, a warning	*/
-/*  occurs.  If the hex file doesn't open correctly, a fatal error	*/
-/*  occurs.  If no hex file is open, all calls to hputc(), hseek(), and	*/
-/*  hclose() have no effect.						*/
+{
+    ropen(&hex,nam,FALSE,TWOHEX,HEXOPEN);
+    return;
+}
 
-void hopen(char *nam)
+void sopen(char *nam)
+
+{
+    ropen(&srec,nam,TRUE,TWOSREC,SRECOPEN);
+    return;
+}
+
+static void ropen(RECFILE *r, char *nam, int s, char *twice, char *fail)
 
 {
+    SCRATCH unsigned i;
+    static char digit[] = "0123456789ABCDEF";
 
-    if (hex) warning(TWOHEX);
-    else if (!(hex = fopen(nam,"w"))) fatal_error(HEXOPEN);
+    if (r -> fp) { warning(twice);  return; }
+    if (!(r -> fp = wopen(nam,"w"))) fatal_error(fail);
+    if (!himage && !(himage = malloc((size_t) IMAGESIZE))) fatal_error(NOMEM);
+    r -> hlen = 0;  r -> srec = s;
+    for (i = 0; i < 256; ++i) {
+	hexpair[2 * i] = digit[i >> 4];  hexpair[2 * i + 1] = digit[i & 0x0f];
+    }
     return;
 }
 
-/*  Hex file write routine.  The data byte is appended to the current	*/
-/*  record.  If the record fills up, it gets written to disk.  If the	*/
-/*  disk fills up, a fatal error occurs.				*/
+/*  Hex record length routine.  Each record holds up to the given	*/
+/*  number of data bytes, from 1 to 255.  S-records hold at most 252.	*/
 
-void hputc(unsigned c) // from hputc() HRJ
+void hlength(unsigned n)
 
 {
+    hsize = n;
+    return;
+}
 
-    if (hex) {
-	buf[cnt++] = c;
-	if (cnt == HEXSIZE) record(0);
-    }
+/*  Hex file overlap check routine.  Returns TRUE if any of the next n	*/
+/*  bytes would go to an address that has already been written.  This	*/
+/*  is checked whether or not a hex file is open.			*/
+
+int hcheck(unsigned n)
+
+{
+    SCRATCH unsigned a;
+
+    if (hmarked)
+	for (a = haddr; n--; a = word(a + 1))
+	    if (hused[a >> 3] & (1 << (a & 7))) return TRUE;
+    return FALSE;
+}
+
+/*  Hex file write routine.  The data byte is laid into the image at	*/
+/*  the current load address, which then moves up by one.		*/
+
+void hputc(unsigned c) // from hputc() HRJ
+
+{
+    hused[haddr >> 3] |= 1 << (haddr & 7);  hmarked = TRUE;
+    if (himage) himage[haddr] = c;
+    haddr = word(haddr + 1);
     return;
 }
 
 /*  Hex file address set routine.  The specified address becomes the	*/
-/*  load address of the next record.  If a record is currently open,	*/
-/*  it gets written to disk.  If the disk fills up, a fatal error	*/
-/*  occurs.								*/
+/*  load address of the next byte.					*/
 
 void hseek(unsigned a)
 
 {
+    haddr = a;
+    return;
+}
+
+/*  Hex file close routine.  The image is formed into records, the EOF	*/
+/*  record is added, and the files are closed.  The Intel EOF record	*/
+/*  carries the load address that the assembly finished at.  If the	*/
+/*  disk fills up, a fatal error occurs.  The hex file routines are	*/
+/*  then set up for the next assembly.					*/
 
-    if (hex) {
-	if (cnt) record(0);
-	addr = a;
+void hclose(void)
+{
+    rclose(&hex);  rclose(&srec);
+    hclear();
+    return;
+}
+
+static void rclose(RECFILE *r)
+
+{
+    SCRATCH FILE *f;
+    SCRATCH unsigned long a, e;
+    SCRATCH unsigned n, max;
+
+    if (r -> fp) {
+	if (r -> srec) record(r,HEADREC,0,0);
+	max = r -> srec && hsize > SRECMAX ? SRECMAX : hsize;
+	for (a = 0; a < IMAGESIZE; a = e) {
+	    if (!hused[a >> 3]) { e = (a | 7) + 1;  continue; }
+	    if (!(hused[a >> 3] & (1 << (a & 7)))) { e = a + 1;  continue; }
+	    for (e = a + 1; e < IMAGESIZE && e - a < max &&
+		(hused[e >> 3] & (1 << (e & 7))); ++e);
+	    n = e - a;
+	    record(r,DATAREC,(unsigned) a,n);
+	}
+	record(r,ENDREC,haddr,0);
+	hflush(r);
+	f = r -> fp;  r -> fp = NULL;
+	if (wclose(f) == EOF) fatal_error(DSKFULL);
     }
     return;
 }
 
-/*  Hex file close routine.  Any open record is written to disk, the	*/
-/*  EOF record is added, and file is closed.  If the disk fills up, a	*/
-/*  fatal error occurs.							*/
+static void hclear(void)
+
+{
+    free(himage);  himage = NULL;
+    if (hmarked) memset(hused,0,sizeof(hused));
+    hmarked = FALSE;  haddr = 0;  hsize = HEXSIZE;
+    return;
+}
+
+/*  Record forming routine.  An Intel HEX record carries its type and	*/
+/*  a two's complement checksum.  An S-record has S0, S1, or S9 in	*/
+/*  place of the type, counts its address and checksum bytes in its	*/
+/*  length, and carries a one's complement checksum.  The data bytes	*/
+/*  come from the image at the record's address.			*/
+
+static void record(RECFILE *r, unsigned typ, unsigned a, unsigned n)
 
-void hclose(void)
 {
+    SCRATCH char *p;
+    SCRATCH unsigned char *d;
+    SCRATCH unsigned i, sum;
+
+    if (r -> hlen + HEXREC > HEXBUF) hflush(r);
+    p = r -> hbuf + r -> hlen;
 
-    if (hex) {
-	   if (cnt) record(0);
-	   record(1);
-	   if (fclose(hex) == EOF) fatal_error(DSKFULL);
+    if (r -> srec) {
+	*p++ = 'S';  *p++ = "190"[typ];
+	sum = n + 3 + high(a) + low(a);
+	p = putb(p,n + 3);  p = putb(p,high(a));  p = putb(p,low(a));
     }
+    else {
+	sum = n + high(a) + low(a) + typ;
+	*p++ = ':';  p = putb(p,n);  p = putb(p,high(a));
+	p = putb(p,low(a));  p = putb(p,typ);
+    }
+    for (d = himage + a, i = 0; i < n; ++i) { p = putb(p,d[i]);  sum += d[i]; }
+    p = putb(p,r -> srec ? low(~sum) : low(0-sum));  *p++ = '\n'; /* was (-sum) HRJ*/
+
+    r -> hlen = p - r -> hbuf;
     return;
 }
 
-static void record(unsigned typ)
+static char *putb(char *p, unsigned b)
 
 {
+    *p++ = hexpair[2 * b];  *p++ = hexpair[2 * b + 1];
+    return p;
+}
+
+/*  Write the formed records to disk.  If the disk fills up, a fatal	*/
+/*  error occurs.							*/
+
+static void hflush(RECFILE *r)
+
+{
+    if (r -> hlen && fwrite(r -> hbuf,1,r -> hlen,r -> fp) != r -> hlen)
+	fatal_error(DSKFULL);
+    r -> hlen = 0;
+    return;
+}
+
+/*  Buffer storage for binary image file.  The object code is laid into	*/
+/*  a 64K memory image, and the image is written to the binary file	*/
+/*  with one fwrite() when the file is closed.  Addresses that no code	*/
+/*  was assembled into, like the gaps left by ORG and DS, hold the fill	*/
+/*  byte.  The image is drawn from the heap at the first write so that	*/
+/*  the fill byte can be set after the file is named, unless the	*/
+/*  library caller has handed in an image buffer of its own.		*/
+
+static TLOCAL FILE *bin = NULL;
+static TLOCAL unsigned char *image = NULL;
+static TLOCAL unsigned bpos = 0;
+static TLOCAL unsigned long blo = IMAGESIZE, bhi = 0;
+static TLOCAL unsigned long rlo = 0, rhi = 0;
+static TLOCAL unsigned fill = FILLBYTE;
+static TLOCAL int bmem = FALSE;
+
+/*  Binary file open routine.  If a binary file is already open, a	*/
+/*  warning occurs.  If the binary file doesn't open correctly, a fatal	*/
+/*  error occurs.  If no binary file or image buffer is open, all	*/
+/*  calls to bputc() have no effect.					*/
+
+void bopen(char *nam)
+
+{
+    if (bin) warning(TWOBIN);
+    else if (!(bin = wopen(nam,"wb"))) fatal_error(BINOPEN);
+    return;
+}
+
+/*  Binary image buffer routine.  The object code is laid into the	*/
+/*  given buffer of IMAGESIZE bytes, whether or not a binary file is	*/
+/*  open.  The buffer belongs to the caller and is not freed.		*/
+
+void bimage(unsigned char *p)
+
+{
+    image = p;  bmem = TRUE;
+    memset(image,fill,(size_t) IMAGESIZE);
+    return;
+}
+
+/*  Binary file fill byte and address range routines.  The range is	*/
+/*  written in place of the range of addresses that code went into.	*/
+
+void bfill(unsigned b)
+
+{
+    fill = b;
+    return;
+}
+
+void brange(unsigned lo, unsigned hi)
+
+{
+    rlo = lo;  rhi = hi + 1L;
+    return;
+}
+
+/*  Binary file write routine.  The data byte is stored in the image at	*/
+/*  the current load address, which then moves up by one.		*/
+
+void bputc(unsigned c)
+
+{
+    if (bin || bmem) {
+	if (!image) new_image();
+	image[bpos] = c;
+	if (bpos < blo) blo = bpos;
+	if (bpos >= bhi) bhi = bpos + 1L;
+	bpos = word(bpos + 1);
+    }
+    return;
+}
+
+/*  Binary file address set routine.  The specified address becomes the	*/
+/*  load address of the next byte.					*/
+
+void bseek(unsigned a)
+
+{
+    bpos = a;
+    return;
+}
+
+/*  Binary image span routine.  The range of addresses that code went	*/
+/*  into is returned, with the top address not included.		*/
+
+void bspan(unsigned long *lo, unsigned long *hi)
+
+{
+    *lo = blo < bhi ? blo : 0;  *hi = blo < bhi ? bhi : 0;
+    return;
+}
+
+/*  Binary file close routine.  The range of the image that was asked	*/
+/*  for, or else the range that code went into, is written to disk and	*/
+/*  the file is closed.  If the disk fills up, a fatal error occurs.	*/
+/*  The binary image routines are then set up for the next assembly.	*/
+
+void bclose(void)
+
+{
+    SCRATCH FILE *f;
+    if (bin) {
+	if (rhi) { blo = rlo;  bhi = rhi; }
+	if (blo < bhi) {
+	    if (!image) new_image();
+	    if (fwrite(image + blo,1,(size_t) (bhi - blo),bin) != bhi - blo)
+		fatal_error(DSKFULL);
+	}
+	f = bin;  bin = NULL;
+	if (wclose(f) == EOF) fatal_error(DSKFULL);
+    }
+    bclear();
+    return;
+}
+
+static void bclear(void)
+
+{
+    if (!bmem) free(image);
+    image = NULL;  bmem = FALSE;  bpos = 0;
+    blo = IMAGESIZE;  bhi = rlo = rhi = 0;  fill = FILLBYTE;
+    return;
+}
+
+/*  Output file abandon routine.  After a fatal error, the listing,	*/
+/*  hex, S-record, and binary files are closed as they stand.		*/
+
+void abandon(void)
+
+{
+    if (lw.fp) { lend(LSTOP);  wclose(lw.fp);  lw.fp = NULL; }
+    if (hex.fp) { wclose(hex.fp);  hex.fp = NULL; }
+    if (srec.fp) { wclose(srec.fp);  srec.fp = NULL; }
+    hclear();
+    if (bin) { wclose(bin);  bin = NULL; }
+    bclear();
+    return;
+}
+
+/*  Output file open and close routines.  The file name STDNAME stands	*/
+/*  for stdout, which is flushed rather than closed.			*/
+
+static FILE *wopen(char *nam, char *mode)
+
+{
+    return strcmp(nam,STDNAME) ? fopen(nam,mode) : stdout;
+}
+
+static int wclose(FILE *f)
+
+{
+    if (f != stdout) return fclose(f);
+    return ferror(f) ? EOF : fflush(f);
+}
+
+/*  Draw the image from the heap and fill it.  If there's not enough	*/
+/*  memory, a fatal error occurs.					*/
+
+static void new_image(void)
+
+{
+    if (!(image = malloc((size_t) IMAGESIZE))) fatal_error(NOMEM);
+    memset(image,fill,(size_t) IMAGESIZE);
+    return;
+}
+
+/*  Build cache.  The outputs of an assembly are kept in the cache	*/
+/*  directory under a key made by hashing the text of the main source	*/
+/*  file and the options that change the outputs.  A manifest kept	*/
+/*  with them holds the error count and the name and hash of every	*/
+/*  file that the source INCLUDEd, or tried to.  When the key turns up	*/
+/*  again and every INCLUDE file still hashes the same, the outputs	*/
+/*  are copied out of the cache rather than assembled.  The hash is	*/
+/*  64-bit FNV-1a over the whole text, with a final mix so that every	*/
+/*  bit of the key depends on every byte.				*/
+
+#define	CACHETAG	"A85 2"		/*  manifest format version	*/
+#define	TMPTRIES	100		/*  names tried for a new file	*/
+#define	FNVBASIS	14695981039346656037ULL
+#define	FNVPRIME	1099511628211ULL
+
+static void digest(unsigned long long *h, char *p, unsigned n)
+
+{
+    SCRATCH unsigned long long a;
+
+    for (a = *h; n; --n) a = (a ^ (*p++ & 0377)) * FNVPRIME;
+    *h = a;
+    return;
+}
+
+/*  Write a hash out as a 16 digit key, after the final mix.		*/
+
+static void hash_key(char *key, unsigned long long h)
+
+{
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    sprintf(key,"%08lx%08lx",(unsigned long) (h >> 32),(unsigned long) (h & 0xffffffffUL));
+    return;
+}
+
+/*  Hash a block of text, after the name that goes with it if there is	*/
+/*  one, into a 16 digit key.						*/
+
+void text_hash(char *key, char *nam, char *p, unsigned n)
+
+{
+    unsigned long long h;
+
+    h = FNVBASIS;
+    if (nam) digest(&h,nam,strlen(nam) + 1);
+    digest(&h,p,n);
+    hash_key(key,h);
+    return;
+}
+
+/*  Make the cache key of the job and the cache file names that go	*/
+/*  with it.  The first entry in the source cache is the main source.	*/
+
+static void cache_key(JOB *job, char *key)
+
+{
+    SCRATCH SOURCE *f;
+    unsigned long long h;
+    unsigned n;
+    char opts[80];
+
+    f = source_list(&n);
+    h = FNVBASIS;
+    digest(&h,f -> text,f -> len);
+    sprintf(opts,"%s %d %d %x %x %x %d%d%d%d %u",CACHETAG,job -> onepass,
+	job -> range,job -> fill,job -> rlo,job -> rhi,job -> lst != NULL,
+	job -> hex != NULL,job -> bin != NULL,job -> srec != NULL,job -> reclen);
+    digest(&h,opts,strlen(opts));
+    for (n = 0; n < job -> nsyms; ++n)
+	digest(&h,job -> syms[n],strlen(job -> syms[n]) + 1);
+    hash_key(key,h);
+    return;
+}
+
+char *cache_name(JOB *job, char *key, char *ext, char *nam)
+
+{
+    sprintf(nam,"%.*s/%s.%s",MAXLINE,job -> cache,key,ext);
+    return nam;
+}
+
+/*  Hash a file.  It is read into the source cache, so that the files	*/
+/*  of a cache hit are known as well as those of an assembly.  Returns	*/
+/*  FALSE if it doesn't open.						*/
+
+static int hash_file(char *nam, char *key)
+
+{
+    INPUT in;
+
+    if (!open_source(&in,nam)) return FALSE;
+    text_hash(key,NULL,in.text,in.end - in.text);
+    return TRUE;
+}
+
+/*  Copy a file into an open file, which is then closed.  Returns	*/
+/*  FALSE if that fails.						*/
+
+static int copy_out(char *from, FILE *out)
+
+{
+    SCRATCH FILE *in;
+    SCRATCH unsigned n;
+    SCRATCH int ok;
+    char b[BUFSIZ];
+
+    if (!(in = fopen(from,"rb"))) { fclose(out);  return FALSE; }
+    while ((n = fread(b,1,BUFSIZ,in)) && fwrite(b,1,n,out) == n);
+    ok = !ferror(in) && !ferror(out);
+    fclose(in);
+    return (fclose(out) != EOF) && ok;
+}
+
+/*  Copy one file to another.  Returns FALSE if that fails.		*/
+
+static int copy_file(char *from, char *to)
+
+{
+    SCRATCH FILE *out;
+
+    if (!(out = fopen(to,"wb"))) return FALSE;
+    return copy_out(from,out);
+}
+
+/*  Open a new file for writing under a name of its own next to the	*/
+/*  given one.  The file is opened only if nothing of that name is	*/
+/*  there yet, so no other assembly, in this process or another one	*/
+/*  sharing the cache, can be writing it too.  Returns NULL if no such	*/
+/*  file can be made.							*/
+
+static FILE *tmp_open(char *tmp, char *to, char *mode)
+
+{
+    SCRATCH FILE *fp;
     SCRATCH unsigned i;
+    static TLOCAL unsigned serial = 0;
+    char m[4];
+
+    sprintf(m,"%.2sx",mode);
+    for (i = 0; i < TMPTRIES; ++i) {
+	sprintf(tmp,"%s.%lx.%x",to,(unsigned long) (size_t) &serial,serial++);
+	if ((fp = fopen(tmp,m))) return fp;
+	if (errno != EEXIST) break;
+    }
+    return NULL;
+}
+
+/*  Put a file into the cache.  It is copied under a name of its own	*/
+/*  first and then renamed, so that nobody else reading the cache can	*/
+/*  see it half written.						*/
+
+static int cache_file(char *from, char *to)
+
+{
+    SCRATCH FILE *fp;
+    char tmp[MAXLINE + 96];
+
+    if (!(fp = tmp_open(tmp,to,"wb"))) return FALSE;
+    if (copy_out(from,fp) &&
+	(!rename(tmp,to) || (!remove(to) && !rename(tmp,to)))) return TRUE;
+    remove(tmp);
+    return FALSE;
+}
+
+/*  Build cache lookup routine.  If the job is in the cache, its	*/
+/*  outputs are copied out, the error count is set, and TRUE is		*/
+/*  returned.  Otherwise, FALSE is returned.				*/
+
+int cache_get(JOB *job)
+
+{
+    SCRATCH FILE *fp;
+    SCRATCH char *p;
+    SCRATCH int ok;
+    char key[20], hash[20], nam[MAXLINE + 64], line[MAXLINE + 64];
+    int n;
+
+    cache_key(job,key);
+    if (!(fp = fopen(cache_name(job,key,"man",nam),"r"))) return FALSE;
+    ok = fgets(line,sizeof(line),fp) && sscanf(line,CACHETAG " %d",&n) == 1;
+
+    while (ok && fgets(line,sizeof(line),fp)) {
+	for (p = line; *p && *p != '\n'; ++p);
+	*p = '\0';
+	if (strlen(line) < 18 || line[16] != ' ') ok = FALSE;
+	else if (line[0] == '-') ok = !hash_file(line + 17,hash);
+	else ok = hash_file(line + 17,hash) && !strncmp(line,hash,16);
+    }
+    fclose(fp);
+
+    if (ok && job -> lst) ok = copy_file(cache_name(job,key,"lst",nam),job -> lst);
+    if (ok && job -> hex) ok = copy_file(cache_name(job,key,"hex",nam),job -> hex);
+    if (ok && job -> bin) ok = copy_file(cache_name(job,key,"bin",nam),job -> bin);
+    if (ok && job -> srec) ok = copy_file(cache_name(job,key,"s19",nam),job -> srec);
+    if (ok) errors = n;
+    return ok;
+}
 
-	putc(':',hex);  putb(cnt);  putb(high(addr));
-    putb(low(addr));  putb(typ);
-    for (i = 0; i < cnt; ++i) putb(buf[i]);
-    putb(low(0-sum));  putc('\n',hex); /* was (-sum) HRJ*/
+/*  Build cache store routine.  The outputs of the job that has just	*/
+/*  been assembled are put into the cache, and the manifest goes in	*/
+/*  last.  If the cache can't be written, a warning occurs.		*/
 
-    addr += cnt;  cnt = 0;
+void cache_put(JOB *job)
 
-    if (ferror(hex)) fatal_error(DSKFULL);
+{
+    SCRATCH SOURCE *f, *e;
+    SCRATCH FILE *fp;
+    SCRATCH int ok;
+    char key[20], hash[20], nam[MAXLINE + 64], man[MAXLINE + 96];
+    unsigned n;
+
+    cache_key(job,key);
+    ok = (!job -> lst || cache_file(job -> lst,cache_name(job,key,"lst",nam))) &&
+	(!job -> hex || cache_file(job -> hex,cache_name(job,key,"hex",nam))) &&
+	(!job -> bin || cache_file(job -> bin,cache_name(job,key,"bin",nam))) &&
+	(!job -> srec || cache_file(job -> srec,cache_name(job,key,"s19",nam)));
+
+    cache_name(job,key,"man",nam);
+    if (ok && (fp = tmp_open(man,nam,"w"))) {
+	fprintf(fp,"%s %d\n",CACHETAG,errors);
+	f = source_list(&n);
+	for (e = f + n, ++f; f < e; ++f) {
+	    if (f -> text) text_hash(hash,NULL,f -> text,f -> len);
+	    else strcpy(hash,"----------------");
+	    fprintf(fp,"%s %s\n",hash,f -> name);
+	}
+	ok = !ferror(fp);
+	if (fclose(fp) == EOF || !ok ||
+	    (rename(man,nam) && (remove(nam) || rename(man,nam)))) {
+	    remove(man);  ok = FALSE;
+	}
+    }
+    else ok = FALSE;
+
+    if (!ok) warning(NOCACHE);
     return;
 }
 
-static void putb(unsigned b)
+/*  Dependency file writer.  The output files of the job, or the	*/
+/*  dependency file itself if there are none, depend on every file in	*/
+/*  the source cache that opened.  Each of those but the main source	*/
+/*  also gets an empty rule so that make doesn't stop if it is deleted.	*/
+/*  Returns FALSE if the file can't be written.				*/
+
+int dwrite(JOB *job)
 
 {
-    static char digit[] = "0123456789ABCDEF";
+    SCRATCH SOURCE *f, *e;
+    SCRATCH FILE *fp;
+    SCRATCH unsigned i, t;
+    SCRATCH int ok;
+    char *out[5];
+    unsigned n;
+
+    if (!(fp = fopen(job -> dep,"w"))) return FALSE;
+    out[0] = job -> hex;  out[1] = job -> bin;
+    out[2] = job -> srec;  out[3] = job -> lst;  out[4] = job -> sym;
+    for (i = t = 0; i < 5; ++i)
+	if (out[i] && strcmp(out[i],STDNAME)) {
+	    if (t++) fputc(' ',fp);
+	    dname(fp,out[i]);
+	}
+    if (!t) dname(fp,job -> dep);
+    fputc(':',fp);
+
+    f = source_list(&n);
+    for (e = f + n, t = 0; f < e; ++f)
+	if (f -> text && strcmp(f -> name,STDNAME)) {
+	    fprintf(fp,t++ ? " \\\n " : " ");  dname(fp,f -> name);
+	}
+    fputc('\n',fp);
 
-    putc(digit[b >> 4],hex);  putc(digit[b & 0x0f],hex);
-    sum += b;  return;
+    for (f = source_list(&n) + 1; f < e; ++f)
+	if (f -> text && strcmp(f -> name,STDNAME)) {
+	    fputc('\n',fp);  dname(fp,f -> name);  fprintf(fp,":\n");
+	}
+
+    ok = !ferror(fp);
+    if (fclose(fp) == EOF) ok = FALSE;
+    return ok;
+}
+
+/*  Write a file name to a dependency file, with the characters that	*/
+/*  make treats specially escaped.					*/
+
+static void dname(FILE *fp, char *nam)
+
+{
+    for (; *nam; ++nam) {
+	if (*nam == '$') fputc('$',fp);
+	else if (*nam == ' ' || *nam == '#' || *nam == ':') fputc('\\',fp);
+	fputc(*nam,fp);
+    }
+    return;
 }
 
 /*  Error handler routine.  If the current error code is non-blank,	*/
@@ -508,23 +1319,30 @@ void error(char code)
     return;
 }
 
-/*  Fatal error handler routine.  A message gets printed on the stderr	*/
-/*  device, and the program bombs.					*/
+/*  Fatal error handler routine.  If an assembly job is running, the	*/
+/*  job is abandoned and the message is left for the job's caller.	*/
+/*  Otherwise, a message gets printed on the console, and the program	*/
+/*  bombs.								*/
 
 void fatal_error(char *msg)
 
 {
-    printf("Fatal Error -- %s\n",msg);
+    if (bail) { fatal = msg;  longjmp(*bail,1); }
+    fprintf(CONSOLE,"Fatal Error -- %s\n",msg);
     exit(-1);
 }
 
 /*  Non-fatal error handler routine.  A message gets printed on the	*/
-/*  stderr device, and the routine returns.				*/
+/*  console, or handed to the job's print routine in the library, and	*/
+/*  the routine returns.						*/
 
 void warning(char *msg)
 
 {
-    printf("Warning -- %s\n",msg);
+    char line[MAXLINE + 1];
+
+    sprintf(line,"Warning -- %.*s",MAXLINE - 11,msg);
+    say(line);
     return;
 }
 